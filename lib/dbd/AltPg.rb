@@ -21,9 +21,9 @@ module DBD
 
     # :nodoc:
     Pg_Regex_ParseParams  = %r{        # We look for:
-          ["'?]                        # 1. ? params, "identifiers" or
+          ["'?;]                       # 1. ? params, "identifiers",
                                        #    'literals' (incl. E'', B''
-                                       #    and X'').
+                                       #    and X'') or ; terminators.
       |    --                          # 2. -- SQL comments to end-of-line
       |    /\*                         # 3. /* C-style comments */
       |   \$                           # 4. $Dollar-Quoted-Delimiter$
@@ -31,7 +31,7 @@ module DBD
           \$
     }x     # :nodoc:
 
-    # translate_sql(sql) -> [ subst_sql, action, count_params ]
+    # translate_sql(sql) -> [ subst_sql, count_params, action, multiple ]
     #
     # Translate the given sql string, transforming ?-style placeholders into
     # $1-styles.  Returns the transformed sql query, the lowercased "action"
@@ -46,11 +46,13 @@ module DBD
     # may be the same object as passed into the method.
     #
     # +action+ may be +nil+ if, after ignoring any comments, the sql query
-    # is empty.
+    # is empty.  +multiple+ is true if a top-level ; is followed by more
+    # SQL, i.e., the string holds more than one statement after all.
     def self.translate_sql(sql)
       i = 0
       action = nil
       param_no = 1
+      multiple = false
 
       # Extract and normalize the action, if any, skipping any leading
       # comments
@@ -77,6 +79,21 @@ module DBD
         when "/*"
           # C-style comment, advance past close of comment
           i = sql.index("*/", i+2) + 2 rescue sql.length
+        when ";"
+          # Only comments (or more ;s) may follow the last statement
+          j = i + 1
+          while j = sql.index(Pg_Regex_LocateAction, j)
+            case $~[0]
+            when '--'
+              j = sql.index(?\n, j+2) + 1 rescue sql.length
+            when '/*'
+              j = sql.index("*/", j+2) + 2 rescue sql.length
+            else
+              multiple = true unless $~[0][0] == ?;
+              break
+            end
+          end
+          i += 1
         when "?"
           sql = sql.dup if param_no == 1
 
@@ -92,7 +109,7 @@ module DBD
         end
       end
 
-      return [sql, param_no - 1, action]
+      return [sql, param_no - 1, action, multiple]
     end
 
   end # -- module AltPg
@@ -108,5 +125,6 @@ end
 require 'dbd/altpg/driver'
 require 'dbd/altpg/type'
 require 'dbd/altpg/database'
+require 'dbd/altpg/router'
 require 'dbd/altpg/statement'
 require 'dbd/altpg/pq'
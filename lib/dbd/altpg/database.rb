@@ -18,6 +18,12 @@ class DBI::DBD::AltPg::Database < DBI::BaseDatabase
       __show_variable('client_encoding')
     when 'altpg_socket'
       pq_socket
+    when 'altpg_result_memory'
+      pq_result_memory[0]
+    when 'altpg_result_memory_peak'
+      pq_result_memory[1]
+    when 'altpg_catalog_ttl'
+      @attr[key]
     when /^altpg_/
       raise DBI::NotSupportedError, "Option dbh['#{key}'] is not supported"
     else
@@ -35,8 +41,16 @@ class DBI::DBD::AltPg::Database < DBI::BaseDatabase
       end
     when 'altpg_client_encoding'
       __set_variable('client_encoding', value)
-    when 'altpg_socket'
+    when 'altpg_socket', 'altpg_result_memory'
       raise DBI::ProgrammingError, "Attempt to modify read-only dbh['#{key}']"
+    when 'altpg_result_memory_peak'
+      # Any assignment restarts the high-water mark from current usage
+      return pq_result_memory_reset
+    when 'altpg_catalog_ttl'
+      unless value.nil? or value.is_a?(Numeric)
+        raise DBI::ProgrammingError, "dbh['#{key}'] must be a number of seconds or nil"
+      end
+      __catalog_flush
     when /^altpg_/
       self[key] # may raise DBI::NotSupported
       raise DBI::ProgrammingError, "Attempt to modify read-only attribute dbh['#{key}']"
@@ -53,6 +67,11 @@ class DBI::DBD::AltPg::Database < DBI::BaseDatabase
     @handle.db
   end
 
+  def rollback
+    __catalog_flush  # the transaction may have loaded the cache
+    pq_rollback
+  end
+
   def ping
     self.do('')
     true # PGRES_COMMAND_EMPTY is not an error for us
@@ -61,6 +80,8 @@ class DBI::DBD::AltPg::Database < DBI::BaseDatabase
   end
 
   def tables
+    return catalog[:relids].keys if catalog_cached?
+
     # SQL taken from dbd-pg-0.3.9
     make_dbh.select_all(<<'eosql').collect { |row| row[0] }
 SELECT
@@ -75,8 +96,302 @@ eosql
     end
 
   def columns(table)
-    # love this SQL
-    make_dbh.prepare(<<'eosql') do |sth|
+    if catalog_cached?
+      relid = catalog[:relids][table]
+      return relid ? catalog[:columns][relid].collect { |h| h.dup } : []
+    end
+
+    relids, columns = load_columns('c.relname = ?', table)
+    columns.values.first || []
+  end
+
+  #
+  # dbh.func(:catalog_preload) => number of tables and views
+  #
+  # (Re)load the column metadata of every visible table and view into the
+  # per-connection catalog cache, in a single query.  The cache is
+  # consulted by #tables and #columns only while dbh['altpg_catalog_ttl']
+  # is set, and is discarded when that many seconds have passed since it
+  # was loaded.  Unset (+nil+) by default.
+  #
+  # Example:
+  #   dbh['altpg_catalog_ttl'] = 300
+  #   dbh.tables.each { |t| orm_setup(t, dbh.columns(t)) } # one round trip
+  def __catalog_preload
+    relids, columns = load_columns('TRUE')
+    @catalog = { :loaded_at => Time.now,
+                 :relids    => relids,      # relname => pg_class.oid
+                 :columns   => columns }    # pg_class.oid => [ column, ... ]
+    relids.size
+  end
+
+  #
+  # dbh.func(:catalog_flush) => nil
+  #
+  # Discard the catalog cache.  This happens implicitly when DDL (or SET,
+  # which may change the search_path) is prepared through this handle.
+  def __catalog_flush
+    @catalog = nil
+  end
+
+  def prepare(query)
+    sql, param_count, action = DBI::DBD::AltPg.translate_sql(query)
+    preparable = case action
+                 when "select", "delete", "insert", "update", "values"
+                   true
+                 else
+                   false
+                 end
+    catalog_invalidated_by(action)
+    DBI::DBD::AltPg::Statement.new(self, sql, param_count, preparable)
+  end
+
+  #
+  # dbh.func(:pq_notifies, timeout = 0) => [ notify, pid ]
+  # dbh.func(:pq_notifies, timeout = 0) { |notify, pid| block }
+  #
+  # Enhanced interface to the PQnotifies() function, accessed via the
+  # DBI::DatabaseHandle#func interface.  Returns the next pending NOTIFY
+  # signal (as a string) and notifier pid, or +nil+ if no NOTIFY signals
+  # have been delivered.
+  #
+  # If your version of the DBI supports block arguments to #func(), this
+  # method may instead pass all pending NOTIFYs to a user-supplied block.
+  #
+  # If given, the optional timeout controls how long to wait for the
+  # arrival of at least one NOTIFY.
+  #
+  # Example:
+  #   dbh.do('LISTEN shutdown')
+  #   dbh.do('LISTEN reload')
+  #   dbh.do('LISTEN run_stats')
+  #
+  #   MyApp.reload()
+  #   loop do
+  #     notify, pid = dbh.func(:pq_notifies, -1) # wait around forever
+  #     puts "Received #{notify} signal from pid #{pid}"
+  #     case notify
+  #     when 'shutdown'
+  #       MyApp.shutdown()
+  #     when 'reload'
+  #       MyApp.reload()
+  #     when 'run_stats'
+  #       ...
+  #     end
+  #   end
+  def __pq_notifies(timeout = 0, &p)
+    # Had originally implemented this in terms of Kernel.select and
+    # IO.for_fd, but that might lead to impolite action at a
+    # distance:  http://redmine.ruby-lang.org/issues/show/2250
+    #
+    # So, select(2) logic is pushed into C, where we don't need IO
+    # objects.
+    pq_notifies(timeout, &p)
+  end
+
+  # Default chunk size, in bytes, for __lo_import and __lo_export
+  LO_CHUNK_SIZE = 256 * 1024
+
+  #
+  # dbh.func(:lo_creat)                           => oid
+  # dbh.func(:lo_open, oid, mode = INV_READ)      => fd
+  # dbh.func(:lo_read, fd, len, buf = '')         => buf or nil
+  # dbh.func(:lo_write, fd, data)                 => bytes written
+  # dbh.func(:lo_seek, fd, offset, whence = IO::SEEK_SET) => new position
+  # dbh.func(:lo_tell, fd)                        => position
+  # dbh.func(:lo_close, fd)                       => 0
+  # dbh.func(:lo_unlink, oid)                     => 1
+  #
+  # Large object access, modeled on libpq's lo_* functions but sharing the
+  # driver's non-blocking wait loop rather than blocking in PQfn().  +mode+
+  # is some combination of DBI::DBD::AltPg::INV_READ and INV_WRITE.
+  #
+  # Large object descriptors are only valid inside a transaction, so
+  # lo_open requires that AutoCommit be off.  Data is moved at most +len+
+  # bytes at a time; __lo_read fills the caller's +buf+ in place and
+  # returns +nil+ at end-of-object, as IO#read does.
+  #
+  # Example:
+  #   dbh['AutoCommit'] = false
+  #   fd = dbh.func(:lo_open, oid)
+  #   buf = ''
+  #   while dbh.func(:lo_read, fd, 65536, buf)
+  #     digest << buf
+  #   end
+  #   dbh.func(:lo_close, fd)
+  def __lo_creat
+    pq_lo_int('SELECT pg_catalog.lo_creat(-1)', [])
+  end
+
+  def __lo_open(oid, mode = DBI::DBD::AltPg::INV_READ)
+    unless in_transaction?
+      raise DBI::ProgrammingError, "Large objects may only be opened within a transaction"
+    end
+    pq_lo_int('SELECT pg_catalog.lo_open($1, $2)', [oid, mode])
+  end
+
+  def __lo_read(fd, len, buf = '')
+    pq_lo_read(fd, len, buf)
+  end
+
+  def __lo_write(fd, data)
+    pq_lo_write(fd, data)
+  end
+
+  def __lo_seek(fd, offset, whence = ::IO::SEEK_SET)
+    # IO::SEEK_{SET,CUR,END} agree with the server's whence values
+    pq_lo_int('SELECT pg_catalog.lo_lseek($1, $2, $3)', [fd, offset, whence])
+  end
+
+  def __lo_tell(fd)
+    pq_lo_int('SELECT pg_catalog.lo_tell($1)', [fd])
+  end
+
+  def __lo_close(fd)
+    pq_lo_int('SELECT pg_catalog.lo_close($1)', [fd])
+  end
+
+  def __lo_unlink(oid)
+    pq_lo_int('SELECT pg_catalog.lo_unlink($1)', [oid])
+  end
+
+  #
+  # dbh.func(:lo_import, source, chunk_size = LO_CHUNK_SIZE) => oid
+  #
+  # Create a new large object from +source+, a filename or any object
+  # responding to read(len, buf), streaming +chunk_size+ bytes at a time.
+  # A transaction is begun and committed around the import if one is not
+  # already underway.
+  def __lo_import(source, chunk_size = LO_CHUNK_SIZE)
+    with_transaction do
+      oid = __lo_creat
+      fd = __lo_open(oid, DBI::DBD::AltPg::INV_WRITE)
+      with_lo_io(source, 'rb') do |io|
+        buf = ''
+        while io.read(chunk_size, buf)
+          pq_lo_write(fd, buf)
+        end
+      end
+      __lo_close(fd)
+      oid
+    end
+  end
+
+  #
+  # dbh.func(:lo_export, oid, dest, chunk_size = LO_CHUNK_SIZE) => bytes
+  #
+  # Copy large object +oid+ to +dest+, a filename or any object responding
+  # to write(), streaming +chunk_size+ bytes at a time.  Returns the number
+  # of bytes copied.
+  def __lo_export(oid, dest, chunk_size = LO_CHUNK_SIZE)
+    with_transaction do
+      fd = __lo_open(oid, DBI::DBD::AltPg::INV_READ)
+      total = 0
+      with_lo_io(dest, 'wb') do |io|
+        buf = ''
+        while pq_lo_read(fd, chunk_size, buf)
+          io.write(buf)
+          total += buf.length
+        end
+      end
+      __lo_close(fd)
+      total
+    end
+  end
+
+  #
+  # dbh.func(:do_batch, [ sql, [sql, param, ...], ... ]) => [ rows, ... ]
+  #
+  # Execute a batch of statements in a single network round trip,
+  # returning each statement's row count (or +nil+) as #do would.  Each
+  # element is either a SQL string or an Array of a SQL string and its
+  # parameters, and must hold exactly one statement.
+  #
+  # Unparameterized batches are sent as one simple protocol query.  Batches
+  # with parameters are pipelined through the extended protocol, if libpq
+  # supports it, or else executed one by one.  Outside of a transaction the
+  # batch is atomic:  should any statement fail, none take effect.
+  #
+  # On failure, a DBI::DatabaseError is raised whose message names, and
+  # whose +err+ is, the zero-based index of the failing statement.
+  #
+  # Example:
+  #   dbh.func(:do_batch, [ 'CREATE TABLE t (i INT)',
+  #                         [ 'INSERT INTO t VALUES (?)', 1 ],
+  #                         [ 'INSERT INTO t VALUES (?)', 2 ],
+  #                         'DELETE FROM t WHERE i > 1' ])
+  #   # => [ nil, 1, 1, 1 ]
+  def __do_batch(statements)
+    batch = statements.collect do |stmt|
+      query, *params = stmt
+      sql, param_count, action, multiple = DBI::DBD::AltPg.translate_sql(query)
+      unless action
+        raise DBI::ProgrammingError, "Empty statement in batch"
+      end
+      if multiple
+        raise DBI::ProgrammingError, "Batch element holds more than one statement: #{query}"
+      end
+      unless params.length == param_count
+        raise DBI::ProgrammingError, "#{params.length} parameters supplied, but batch statement requires #{param_count}"
+      end
+      catalog_invalidated_by(action)
+      [ sql.sub(/;\s*\z/, ''), params, query ]
+    end
+    return [] if batch.empty?
+
+    if batch.all? { |sql, params| params.empty? }
+      # Newlines keep a trailing -- comment from swallowing the separator
+      pq_exec_batch(batch.collect { |sql, params| sql }.join("\n;\n"), batch.length)
+    elsif respond_to?(:pq_exec_pipeline, true)
+      batch.each do |sql, params|
+        params.collect! do |value|
+          # Typed as for a Statement, but with no DESCRIBE to refine them
+          translated = ::DBI::DBD::AltPg::Statement.translate_param(value)
+          translated[1] = translated[1] == :unknown ? 0 : @type_map[ translated[1] ][:oid]
+          translated
+        end
+      end
+      pq_exec_pipeline(batch)
+    else
+      with_transaction do
+        i = -1
+        batch.collect do |sql, params, query|
+          begin
+            i += 1
+            make_dbh.do(query, *params)    # prepare wants ?-placeholders
+          rescue ::DBI::DatabaseError => e
+            raise e.class.new("batch statement #{i}: #{e.message}", i, e.state)
+          end
+        end
+      end
+    end
+  end
+
+  def __set_variable(var, value, is_local = false)
+    catalog_invalidated_by("set")   # e.g., search_path changes visibility
+    make_dbh.do('SELECT pg_catalog.set_config(?, ?, ?)', var, value, !!is_local)
+  rescue ::DBI::DatabaseError => e
+    if e.state =~ /^42/ or e.state == "22023" # invalid_parameter_value
+      e = ::DBI::ProgrammingError.new(e.message, e.err, e.state)
+    end
+    raise e
+  end
+
+  def __show_variable(var)
+    make_dbh.select_one('SELECT pg_catalog.current_setting(?)', var)[0]
+  rescue ::DBI::DatabaseError => e
+    if e.state =~ /^42/
+      e = ::DBI::ProgrammingError.new(e.message, e.err, e.state)
+    end
+    raise e
+  end
+
+  private
+
+  # Column metadata for visible tables and views matching +condition+,
+  # one row per column, or a single row with NULL name for a table without
+  # columns.
+  ColumnsSQL = <<'eosql' # :nodoc:
 SELECT
   a.attname                    AS name,
   t.typname                    AS type_name,
@@ -91,17 +406,22 @@ SELECT
     ELSE NULL
   END                          AS scale,
   NOT a.attnotnull             AS nullable,
-  d.adsrc                      AS default,
+  pg_catalog.pg_get_expr(d.adbin, d.adrelid)
+                               AS default,
   COALESCE(ii.indexed, false)  AS indexed,
   COALESCE(iu.unique, false)   AS unique,
   COALESCE(ip.primary, false)  AS primary,
   a.atttypid                   AS pg_type,
-  a.attlen                     AS pg_typlen
+  a.attlen                     AS pg_typlen,
+  c.oid::bigint                AS pg_relid,
+  c.relname                    AS pg_relname
 FROM
   pg_catalog.pg_class c
-  INNER JOIN
+  LEFT JOIN
   pg_catalog.pg_attribute a ON c.oid = a.attrelid
-  INNER JOIN
+                               AND a.attnum > 0        -- regular column
+                               AND NOT a.attisdropped  -- not dropped
+  LEFT JOIN
   pg_catalog.pg_type t ON t.oid = a.atttypid
   LEFT JOIN
   pg_catalog.pg_attrdef d ON d.adrelid = c.oid AND d.adnum = a.attnum
@@ -143,102 +463,84 @@ FROM
    GROUP BY 1, 2, 3) ip
      ON ip.attname = a.attname AND ip.tbl_oid = c.oid
 WHERE
-  a.attnum > 0                          -- regular column
-    AND
-  NOT a.attisdropped                    -- which has not been dropped
-    AND
-  c.relkind IN ('r','v')                -- belonging to a TABLE or VIEW
-    AND
-  c.relname = ?                         -- named ?, which TABLE/VIEW is
+  c.relkind IN ('r','v')                -- a TABLE or VIEW
     AND
   pg_catalog.pg_table_is_visible(c.oid) -- visible without qualification
+    AND
+  %s
 ORDER BY
-  a.attnum ASC
+  c.oid, a.attnum ASC
 eosql
-      sth.execute(table)
 
-      ret = []
-      sth.collect do |row|
-        h = Hash[ *sth.column_names.zip(row).flatten ]
+  # load_columns(condition, *params) -> [ relids, columns ]
+  #
+  # Run ColumnsSQL, returning a Hash of relname => relid and a Hash of
+  # relid => [ column, ... ] for the matching tables and views.
+  def load_columns(condition, *params)
+    relids = {}
+    columns = {}
+
+    make_dbh.prepare(ColumnsSQL % condition) do |sth|
+      sth.execute(*params)
+      names = sth.column_names
+
+      sth.each do |row|
+        h = Hash[ *names.zip(row.to_a).flatten ]
+        relid = h.delete('pg_relid')
+        relids[h.delete('pg_relname')] = relid
+        cols = (columns[relid] ||= [])
+        next if h['name'].nil?  # a table without columns
+
         h['dbi_type'] = @type_map[ h['type_name'] ]
-        h
+        cols << h
       end
-    end # -- prepare do |sth|
+    end
+
+    [relids, columns]
   end
 
-  def prepare(query)
-    sql, param_count, action = DBI::DBD::AltPg.translate_sql(query)
-    preparable = case action
-                 when "select", "delete", "insert", "update", "values"
-                   true
-                 else
-                   false
-                 end
-    DBI::DBD::AltPg::Statement.new(self, sql, param_count, preparable)
+  # Is the catalog cache enabled?  (Re)load it if so and it is stale.
+  def catalog_cached?
+    ttl = @attr['altpg_catalog_ttl'] or return false
+    if @catalog.nil? or Time.now - @catalog[:loaded_at] > ttl
+      __catalog_preload
+    end
+    true
   end
 
-  #
-  # dbh.func(:pq_notifies, timeout = 0) => [ notify, pid ]
-  # dbh.func(:pq_notifies, timeout = 0) { |notify, pid| block }
-  #
-  # Enhanced interface to the PQnotifies() function, accessed via the
-  # DBI::DatabaseHandle#func interface.  Returns the next pending NOTIFY
-  # signal (as a string) and notifier pid, or +nil+ if no NOTIFY signals
-  # have been delivered.
-  #
-  # If your version of the DBI supports block arguments to #func(), this
-  # method may instead pass all pending NOTIFYs to a user-supplied block.
-  #
-  # If given, the optional timeout controls how long to wait for the
-  # arrival of at least one NOTIFY.
-  #
-  # Example:
-  #   dbh.do('LISTEN shutdown')
-  #   dbh.do('LISTEN reload')
-  #   dbh.do('LISTEN run_stats')
-  #
-  #   MyApp.reload()
-  #   loop do
-  #     notify, pid = dbh.func(:pq_notifies, -1) # wait around forever
-  #     puts "Received #{notify} signal from pid #{pid}"
-  #     case notify
-  #     when 'shutdown'
-  #       MyApp.shutdown()
-  #     when 'reload'
-  #       MyApp.reload()
-  #     when 'run_stats'
-  #       ...
-  #     end
-  #   end
-  def __pq_notifies(timeout = 0, &p)
-    # Had originally implemented this in terms of Kernel.select and
-    # IO.for_fd, but that might lead to impolite action at a
-    # distance:  http://redmine.ruby-lang.org/issues/show/2250
-    #
-    # So, select(2) logic is pushed into C, where we don't need IO
-    # objects.
-    pq_notifies(timeout, &p)
+  def catalog
+    @catalog
   end
 
-  def __set_variable(var, value, is_local = false)
-    make_dbh.do('SELECT pg_catalog.set_config(?, ?, ?)', var, value, !!is_local)
-  rescue ::DBI::DatabaseError => e
-    if e.state =~ /^42/ or e.state == "22023" # invalid_parameter_value
-      e = ::DBI::ProgrammingError.new(e.message, e.err, e.state)
+  # Flush the catalog cache ahead of statements which may change it.
+  def catalog_invalidated_by(action)
+    case action
+    when "create", "alter", "drop", "comment", "set", "reset",
+         "rollback", "abort"
+      __catalog_flush
     end
-    raise e
   end
 
-  def __show_variable(var)
-    make_dbh.select_one('SELECT pg_catalog.current_setting(?)', var)[0].taint
-  rescue ::DBI::DatabaseError => e
-    if e.state =~ /^42/
-      e = ::DBI::ProgrammingError.new(e.message, e.err, e.state)
+  # Run the block inside a transaction, beginning and committing one
+  # ourselves only if necessary.
+  def with_transaction
+    return yield if in_transaction?
+
+    self.do('BEGIN')
+    begin
+      ret = yield
+    rescue Exception
+      self.do('ROLLBACK') rescue nil
+      raise
     end
-    raise e
+    self.do('COMMIT')
+    ret
   end
 
-  private
+  def with_lo_io(target, mode)
+    return yield(target) unless target.is_a?(String)
+    File.open(target, mode) { |io| yield io }
+  end
 
   def make_dbh
     dbh = ::DBI::DatabaseHandle.new(self)
@@ -9,6 +9,12 @@ class DBI::DBD::AltPg::Driver < DBI::BaseDriver
     s << "user='#{user}'" if user
     s << "password='#{auth}'" if auth
 
+    # 'altpg_replicas' => conninfo or [ conninfo, ... ] routes reads to
+    # standbys; see DBI::DBD::AltPg::Router
+    if attr and attr['altpg_replicas']
+      return DBI::DBD::AltPg::Router.new( s.join(''), attr['altpg_replicas'], self, attr )
+    end
+
     # FIXME - attributes
     #pq = DBI::DBD::AltPg::Pq.new(s.join(''))
     #DBI::DBD::AltPg::Database.new( pq, self )
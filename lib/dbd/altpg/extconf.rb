@@ -4,6 +4,21 @@ require 'mkmf'
 
 ['pq'].each do |m|
   dir_config(m)
+  if pg_config = find_executable('pg_config')
+    $CPPFLAGS << " -I#{`#{pg_config} --includedir`.chomp}"
+    $LDFLAGS  << " -L#{`#{pg_config} --libdir`.chomp}"
+  end
   have_library('pq')
+  have_func('PQresultMemorySize', 'libpq-fe.h')
+  have_func('PQconninfo', 'libpq-fe.h')
+  have_header('sys/select.h')
+  have_header('ruby/encoding.h')
+  have_header('ruby/io.h')
+  have_header('ruby/thread.h')
+  have_func('rb_wait_for_single_fd', 'ruby/io.h')
+  have_func('rb_thread_call_without_gvl', 'ruby/thread.h')
+  have_func('rb_gc_adjust_memory_usage', 'ruby.h')
+  have_header('ruby/fiber/scheduler.h')
+  have_func('rb_fiber_scheduler_current', 'ruby/fiber/scheduler.h')
   create_makefile('pq')
 end
@@ -1,5 +1,18 @@
 #include <libpq-fe.h>
+#include <libpq/libpq-fs.h>
 #include <ruby.h>
+#ifdef HAVE_RUBY_ENCODING_H
+#include <ruby/encoding.h>
+#endif
+#ifdef HAVE_RUBY_IO_H
+#include <ruby/io.h>
+#endif
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+#ifdef HAVE_RUBY_FIBER_SCHEDULER_H
+#include <ruby/fiber/scheduler.h>
+#endif
 #ifdef HAVE_SYS_SELECT_H
 #include <sys/select.h>
 #endif
@@ -29,6 +42,17 @@ static VALUE rbx_mAltPg;  /* module DBI::DBD::AltPg           */
 static VALUE rbx_cDb;     /* class DBI::DBD::AltPg::Database  */
 static VALUE rbx_cSt;     /* class DBI::DBD::AltPg::Statement */
 
+/* Fixed-width binary types, from the server's catalog/pg_type.h */
+#define ALTPG_BOOLOID         16
+#define ALTPG_INT8OID         20
+#define ALTPG_INT2OID         21
+#define ALTPG_INT4OID         23
+#define ALTPG_FLOAT4OID      700
+#define ALTPG_FLOAT8OID      701
+#define ALTPG_DATEOID       1082
+#define ALTPG_TIMESTAMPOID  1114
+#define ALTPG_TIMESTAMPTZOID 1184
+
 static ID id_translate_parameters;
 static VALUE sym_type_name;
 static VALUE sym_dbi_type;
@@ -41,14 +65,29 @@ struct altpg_params {
 	int *param_formats;
 };
 
+/* PGresult memory held on behalf of one connection.  Shared by the
+ * Database and its Statements, and freed along with the last of them.
+ */
+struct altpg_mem {
+	size_t current;            /* bytes of PGresults now held            */
+	size_t peak;               /* high-water mark of +current+           */
+	int refcnt;
+};
+
 struct AltPg_Db {
 	PGconn *conn;
 	unsigned long serial;  /* pstmt name suffix; may wrap */
+	struct altpg_mem *mem;
 };
 
 struct AltPg_St {
 	PGconn *conn;              /* NULL if finished                       */
 	PGresult *res;             /* non-NULL if executed and not cancelled */
+	PGresult *desc;            /* PQdescribePrepared, once described     */
+	size_t res_size;           /* bytes charged to +mem+ for +res+       */
+	size_t desc_size;          /* ""                         +desc+      */
+	struct altpg_mem *mem;     /* shared with the parent Database        */
+	char cmd_tuples[24];       /* PQcmdTuples(), until execute/finish    */
 	int prepared;              /* non-zero if prepared                   */
 	struct altpg_params params;
 	unsigned int nfields;
@@ -56,6 +95,10 @@ struct AltPg_St {
 	unsigned int row_number;
 };
 
+#ifndef HAVE_RB_GC_ADJUST_MEMORY_USAGE
+#define rb_gc_adjust_memory_usage(diff) ((void)0)
+#endif
+
 /* ==== Helper functions ================================================== */
 
 static VALUE
@@ -80,37 +123,123 @@ raise_dbi_database_error(const char *msg, const char *sqlstate)
 	                                   rb_path2class("DBI::DatabaseError")));
 }
 
+/* Waiting and the GVL
+ *
+ * Threads block only in altpg_wait_fd(), which (on ruby >= 1.9.3) lets
+ * other ruby threads run meanwhile, or, under a ruby 3 Fiber scheduler,
+ * yields to the scheduler so that other fibers run.  Protocol parsing,
+ * which for a large result is real work, happens without the GVL in
+ * altpg_conn_block().
+ */
+
+#define ALTPG_WAIT_READABLE  0x1
+#define ALTPG_WAIT_WRITEABLE 0x4
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+#define altpg_without_gvl(func, arg) \
+	rb_thread_call_without_gvl((func), (arg), RUBY_UBF_IO, NULL)
+#else
+#define altpg_without_gvl(func, arg) (func)(arg)
+#endif
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+/* As altpg_wait_fd(), but via scheduler#io_wait.  (internal) */
+static int
+altpg_scheduler_wait_fd(VALUE scheduler, int fd, int events, struct timeval *tv)
+{
+	VALUE args[2], io, ready;
+	int wanted = 0;
+
+	if (events & ALTPG_WAIT_READABLE)  wanted |= RUBY_IO_READABLE;
+	if (events & ALTPG_WAIT_WRITEABLE) wanted |= RUBY_IO_WRITABLE;
+
+	/* A throwaway IO, which must not close libpq's socket when collected */
+	args[0] = INT2FIX(fd);
+	args[1] = rb_hash_new();
+	rb_hash_aset(args[1], ID2SYM(rb_intern("autoclose")), Qfalse);
+	io = rb_funcallv_kw(rb_cIO, rb_intern("for_fd"), 2, args, RB_PASS_KEYWORDS);
+
+	ready = rb_fiber_scheduler_io_wait(scheduler, io, INT2FIX(wanted),
+	                                   rb_fiber_scheduler_make_timeout(tv));
+	RB_GC_GUARD(io);
+
+	if (FIXNUM_P(ready)) {
+		int r = FIX2INT(ready);
+		int got = ((r & RUBY_IO_READABLE) ? ALTPG_WAIT_READABLE : 0)
+		        | ((r & RUBY_IO_WRITABLE) ? ALTPG_WAIT_WRITEABLE : 0);
+
+		if (got) return got;
+		ready = Qfalse;
+	}
+
+	/* A falsy answer is a timeout, but a scheduler may wake us early.
+	 * Absent a timeout, our callers re-check libpq and wait again.
+	 */
+	return (RTEST(ready) || NULL == tv) ? events : 0;
+}
+#endif
+
+/* Wait for +events+ on +fd+, returning the events ready or zero on
+ * timeout.  A NULL +tv+ waits forever.  (internal)
+ */
 static int
-altpg_thread_select(int nfd, fd_set *rfds, fd_set *wfds, struct timeval *tv)
+altpg_wait_fd(int fd, int events, struct timeval *tv)
 {
-	int r = rb_thread_select(nfd, rfds, wfds, NULL, tv);
-	if (r > 0) return r;
+	int r;
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+	VALUE scheduler = rb_fiber_scheduler_current();
+
+	if (!NIL_P(scheduler))
+		return altpg_scheduler_wait_fd(scheduler, fd, events, tv);
+#endif
+
+#ifdef HAVE_RB_WAIT_FOR_SINGLE_FD
+	int wanted = 0;
+
+	if (events & ALTPG_WAIT_READABLE)  wanted |= RB_WAITFD_IN;
+	if (events & ALTPG_WAIT_WRITEABLE) wanted |= RB_WAITFD_OUT;
+
+	r = rb_wait_for_single_fd(fd, wanted, tv);
+	if (r > 0) {
+		int ready = 0;
+
+		if (r & RB_WAITFD_IN)  ready |= ALTPG_WAIT_READABLE;
+		if (r & RB_WAITFD_OUT) ready |= ALTPG_WAIT_WRITEABLE;
+		return ready ? ready : events;
+	}
+#else
+	fd_set rfds, wfds;
+
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+	if (events & ALTPG_WAIT_READABLE)  FD_SET(fd, &rfds);
+	if (events & ALTPG_WAIT_WRITEABLE) FD_SET(fd, &wfds);
+
+	r = rb_thread_select(fd + 1, &rfds, &wfds, NULL, tv);
+	if (r > 0) {
+		return (FD_ISSET(fd, &rfds) ? ALTPG_WAIT_READABLE : 0)
+		     | (FD_ISSET(fd, &wfds) ? ALTPG_WAIT_WRITEABLE : 0);
+	}
+#endif
 
 	if (r < 0) raise_dbi_internal_error("Internal select() error");
 	if (NULL == tv)
 		raise_dbi_internal_error("Internal select() impossibly timed out");
 
-	return r;
+	return 0;
 }
 
 static int
 fd_await_readable(int fd, struct timeval *tv)
 {
-	fd_set fds;
-
-	FD_ZERO(&fds);
-	FD_SET(fd, &fds);
-	return altpg_thread_select(fd + 1, &fds, NULL, tv);
+	return altpg_wait_fd(fd, ALTPG_WAIT_READABLE, tv);
 }
 
 static int
 fd_await_writeable(int fd, struct timeval *tv)
 {
-	fd_set fds;
-
-	FD_ZERO(&fds);
-	FD_SET(fd, &fds);
-	return altpg_thread_select(fd + 1, NULL, &fds, tv);
+	return altpg_wait_fd(fd, ALTPG_WAIT_WRITEABLE, tv);
 }
 
 static void
@@ -158,7 +287,7 @@ altpg_params_from_ary(struct altpg_params *ap, VALUE ary)
 				ap->param_values[i]  = NULL;
 				ap->param_lengths[i] = 0;
 			} else {
-				SafeStringValue(val);
+				StringValue(val);
 				ap->param_values[i]  = RSTRING_PTR(val);
 				ap->param_lengths[i] = RSTRING_LEN(val);
 			}
@@ -182,30 +311,236 @@ altpg_params_clear(struct altpg_params *ap)
 	MEMZERO(ap, struct altpg_params, 1);
 }
 
-PGresult *
-async_PQgetResult(PGconn *conn)
+struct altpg_consume {
+	PGconn *conn;
+	int ok;
+	int busy;
+};
+
+static void *
+altpg_consume_input_nogvl(void *arg)
 {
-	PGresult *tmp = NULL;
-	PGresult *res = NULL;
-	int fd;
+	struct altpg_consume *c = arg;
+
+	c->ok   = PQconsumeInput(c->conn);
+	c->busy = PQisBusy(c->conn);     /* parses whatever has arrived */
+	return NULL;
+}
+
+static void *
+altpg_get_result_nogvl(void *conn)
+{
+	return PQgetResult(conn);
+}
+
+/* PQgetResult(), which must not block, parsing without the GVL.  (internal) */
+static PGresult *
+altpg_get_result(PGconn *conn)
+{
+	return altpg_without_gvl(altpg_get_result_nogvl, conn);
+}
+
+/* Seconds to wait for a cancelled command's results before giving up on
+ * the connection
+ */
+#define ALTPG_ABANDON_TIMEOUT 5
+
+static void *
+altpg_cancel_nogvl(void *conn)
+{
+	PGcancel *cancel;
+	char errbuf[256];
+
+	if ((cancel = PQgetCancel(conn))) {
+		PQcancel(cancel, errbuf, sizeof(errbuf));
+		PQfreeCancel(cancel);
+	}
+	return NULL;
+}
 
-	fd = PQsocket(conn);
+static void *
+altpg_reset_nogvl(void *conn)
+{
+	PQreset(conn);
+	return NULL;
+}
+
+/* Discard results, without blocking, until the connection is idle.
+ * Qfalse if that takes more than ALTPG_ABANDON_TIMEOUT seconds or the
+ * connection fails.  (internal)
+ */
+static VALUE
+altpg_conn_drain_body(VALUE arg)
+{
+	PGconn *conn = (PGconn *)arg;
+	struct altpg_consume c;
+	struct timeval tv;
+	time_t deadline = time(NULL) + ALTPG_ABANDON_TIMEOUT;
+	int fd = PQsocket(conn);
+	int flushing, nulls = 0, pipeline = 0;
+	PGresult *res;
+
+#ifdef LIBPQ_HAS_PIPELINING
+	pipeline = PQpipelineStatus(conn) != PQ_PIPELINE_OFF;
+#endif
+	c.conn = conn;
+	for (;;) {
+		if ((flushing = PQflush(conn)) < 0)
+			return Qfalse;
+		altpg_without_gvl(altpg_consume_input_nogvl, &c);
+		if (!c.ok)
+			return Qfalse;
+
+		while (!PQisBusy(conn)) {
+			if (NULL == (res = PQgetResult(conn))) {
+				/* A pipeline has a NULL after each command; two in a row
+				 * mean there is nothing more to come.
+				 */
+				if (!pipeline || ++nulls > 1) return Qtrue;
+				continue;
+			}
+			nulls = 0;
+#ifdef LIBPQ_HAS_PIPELINING
+			if (PQresultStatus(res) == PGRES_PIPELINE_SYNC) {
+				/* Our pipelines always end in a Sync */
+				PQclear(res);
+				PQexitPipelineMode(conn);
+				pipeline = 0;
+				continue;
+			}
+#endif
+			PQclear(res);
+		}
+
+		if ((tv.tv_sec = deadline - time(NULL)) <= 0)
+			return Qfalse;
+		tv.tv_usec = 0;
+		if (!altpg_wait_fd(fd, ALTPG_WAIT_READABLE
+		                       | (flushing ? ALTPG_WAIT_WRITEABLE : 0), &tv))
+			return Qfalse;
+	}
+}
+
+/* Cancel the command in progress and discard its results, leaving the
+ * connection idle.  Should the server not oblige in time, or should we be
+ * interrupted again meanwhile, reset the connection and raise instead.
+ * (internal)
+ */
+static void
+altpg_conn_abandon(PGconn *conn)
+{
+	int state = 0;
+	VALUE drained;
+
+	altpg_without_gvl(altpg_cancel_nogvl, conn);  /* blocks */
+
+	drained = rb_protect(altpg_conn_drain_body, (VALUE)conn, &state);
+	if (state || !RTEST(drained)) {
+		altpg_without_gvl(altpg_reset_nogvl, conn);
+		if (PQstatus(conn) == CONNECTION_OK)
+			PQsetnonblocking(conn, 1);
+		raise_dbi_database_error("Could not cancel the command in progress;"
+		                         " connection reset", "08006");
+	}
+}
+
+static VALUE
+altpg_conn_block_body(VALUE arg)
+{
+	PGconn *conn = (PGconn *)arg;
+	struct altpg_consume c;
+	int fd = PQsocket(conn);
+	int r;
 
-	/* Assumption:  we are called immediately after a PQsend(),
-	 *              so we're expecting new, un-PQconsume'd data to
-	 *              arrive
+	/* Our connections are non-blocking, so first push out any pending
+	 * query, reading as we go lest we and the server deadlock.
 	 */
-	fd_await_readable(fd, NULL);
+	while ((r = PQflush(conn)) > 0) {
+		if (altpg_wait_fd(fd, ALTPG_WAIT_READABLE|ALTPG_WAIT_WRITEABLE, NULL)
+		    & ALTPG_WAIT_READABLE) {
+			PQconsumeInput(conn);
+		}
+	}
+	if (r < 0)
+		raise_dbi_database_error(PQerrorMessage(conn), "08000");
 
-	/* ruby-pg-0.8.0 pgconn_block() */
-	PQconsumeInput(conn);
-	while (PQisBusy(conn)) {
+	c.conn = conn;
+	altpg_without_gvl(altpg_consume_input_nogvl, &c);
+	while (c.ok && c.busy) {
 		fd_await_readable(fd, NULL);
-		PQconsumeInput(conn);
+		altpg_without_gvl(altpg_consume_input_nogvl, &c);
+	}
+	if (!c.ok)
+		raise_dbi_database_error(PQerrorMessage(conn), "08000");
+
+	return Qnil;
+}
+
+/* Wait until PQgetResult() would not block.  Should we be interrupted --
+ * by Thread#raise, Timeout, etc. -- cancel the query before propagating
+ * the exception, so that the connection remains usable.  (internal)
+ *
+ * ruby-pg-0.8.0 pgconn_block()
+ */
+static void
+altpg_conn_block(PGconn *conn)
+{
+	int state = 0;
+
+	rb_protect(altpg_conn_block_body, (VALUE)conn, &state);
+	if (state) {
+		if (PQstatus(conn) == CONNECTION_OK && PQisBusy(conn))
+			altpg_conn_abandon(conn);
+		rb_jump_tag(state);
 	}
+}
+
+/* PQclear() a failed +res+ and raise its error as a DBI::DatabaseError.
+ * (internal)
+ */
+static void
+raise_PQresult_error(PGresult *res)
+{
+	VALUE args[3];
+	char *state = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+
+	args[0] = rb_str_new2(PQresultErrorMessage(res));
+	args[1] = Qnil;
+	args[2] = state ? rb_str_new2(state) : Qnil;
+
+	PQclear(res);
+
+	rb_exc_raise(rb_class_new_instance(3,
+	                                   args,
+	                                   rb_path2class("DBI::DatabaseError")));
+}
+
+/* altpg_conn_block() for rb_protect().  (internal) */
+static VALUE
+altpg_conn_block_value(VALUE conn)
+{
+	altpg_conn_block((PGconn *)conn);
+	return Qnil;
+}
+
+PGresult *
+async_PQgetResult(PGconn *conn)
+{
+	PGresult *tmp = NULL;
+	PGresult *res = NULL;
+	int state = 0;
 
-	/* ruby-pg-0.8.0 pgconn_get_last_result(), except we PQclear as needed */
-	while (tmp = PQgetResult(conn)) {
+	/* ruby-pg-0.8.0 pgconn_get_last_result(), except we PQclear as needed.
+	 * Every PQgetResult() is preceded by a wait, lest libpq block within
+	 * it for the rest of the results.
+	 */
+	for (;;) {
+		rb_protect(altpg_conn_block_value, (VALUE)conn, &state);
+		if (state) {
+			if (res) PQclear(res);
+			rb_jump_tag(state);
+		}
+		if (NULL == (tmp = altpg_get_result(conn))) break;
 		if (res) PQclear(res);
 		res = tmp;
 	}
@@ -221,20 +556,8 @@ async_PQgetResult(PGconn *conn)
 	case PGRES_BAD_RESPONSE:
 	case PGRES_FATAL_ERROR:
 	case PGRES_NONFATAL_ERROR:
-		{
-			VALUE args[3];
-
-			args[0] = rb_str_new2(PQresultErrorMessage(res));
-			args[1] = Qnil;
-			args[2] = rb_str_new2(PQresultErrorField(res, PG_DIAG_SQLSTATE));
-
-			PQclear(res);
-
-			rb_exc_raise(rb_class_new_instance(3,
-			                                   args,
-			                                   rb_path2class("DBI::DatabaseError")));
-			break; /* Not reached */
-		}
+		raise_PQresult_error(res);
+		break; /* Not reached */
   default:
 		raise_dbi_internal_error("Unknown/unexpected PQresultStatus");
 	}
@@ -281,6 +604,92 @@ altpg_db_in_transaction(struct AltPg_Db *db)
 	return in_trans;
 }
 
+/* ---------- Result memory accounting ---------------------------------- */
+
+static struct altpg_mem *
+altpg_mem_new(void)
+{
+	struct altpg_mem *mem = ALLOC(struct altpg_mem);
+	MEMZERO(mem, struct altpg_mem, 1);
+	mem->refcnt = 1;
+	return mem;
+}
+
+static struct altpg_mem *
+altpg_mem_ref(struct altpg_mem *mem)
+{
+	mem->refcnt++;
+	return mem;
+}
+
+static void
+altpg_mem_unref(struct altpg_mem *mem)
+{
+	if (mem && --mem->refcnt == 0) xfree(mem);
+}
+
+/* Bytes libpq allocated for +res+.  (internal) */
+static size_t
+altpg_result_size(const PGresult *res)
+{
+#ifdef HAVE_PQRESULTMEMORYSIZE
+	return PQresultMemorySize(res);
+#else
+	/* Pre-12 libpq: the values plus libpq's per-value and per-field
+	 * bookkeeping, which is near enough for the GC's purposes.
+	 */
+	size_t size = 256;
+	int nrows = PQntuples(res), nfields = PQnfields(res);
+	int r, i;
+
+	size += (size_t)nfields * 64;
+	for (r = 0; r < nrows; ++r)
+		for (i = 0; i < nfields; ++i)
+			size += PQgetlength(res, r, i) + 1 + sizeof(int) + sizeof(char *);
+	return size;
+#endif
+}
+
+/* Charge +res+ to +mem+ and tell the GC about it, so that finished but
+ * unreleased results push it toward a collection.  Returns the size
+ * charged, to be handed back to altpg_mem_release().  (internal)
+ */
+static size_t
+altpg_mem_charge(struct altpg_mem *mem, const PGresult *res)
+{
+	size_t size;
+
+	if (!res) return 0;
+
+	size = altpg_result_size(res);
+	if (mem) {
+		mem->current += size;
+		if (mem->current > mem->peak) mem->peak = mem->current;
+	}
+	rb_gc_adjust_memory_usage((ssize_t)size);
+	return size;
+}
+
+/* PQclear(*resp), if any, and undo its charge.  (internal) */
+static void
+altpg_mem_release(struct altpg_mem *mem, PGresult **resp, size_t *sizep)
+{
+	if (!*resp) return;
+
+	PQclear(*resp);
+	*resp = NULL;
+	if (mem) mem->current -= *sizep;
+	rb_gc_adjust_memory_usage(-(ssize_t)*sizep);
+	*sizep = 0;
+}
+
+/* Free an executed result once its rows are consumed.  (internal) */
+static void
+altpg_st_release_result(struct AltPg_St *st)
+{
+	altpg_mem_release(st->mem, &st->res, &st->res_size);
+}
+
 static struct AltPg_St *
 altpg_st_get_unfinished(VALUE self)
 {
@@ -297,13 +706,12 @@ altpg_st_get_unfinished(VALUE self)
 static void
 altpg_st_cancel(struct AltPg_St *st)
 {
-	if (st->res) {
-		PQclear(st->res);            /* Undo any execute()   */
-		st->res = NULL;
-		st->ntuples = 0;
+	if (st->res)
+		altpg_st_release_result(st); /* Undo any execute()   */
 
-		st->row_number = 0;          /* Erase any #fetch     */
-	}
+	/* Even if a full #fetch already released the result */
+	st->ntuples = 0;
+	st->row_number = 0;            /* Erase any #fetch     */
 
 	if (st->params.nparams > 0) {  /* Undo any #bind_param */
 		MEMZERO(st->params.param_values, char *, st->params.nparams);
@@ -316,10 +724,13 @@ altpg_st_cancel(struct AltPg_St *st)
 static void
 AltPg_Db_s_free(struct AltPg_Db *db)
 {
-	if (NULL != db && NULL != db->conn) {
+	if (NULL == db) return;
+	if (NULL != db->conn) {
 		PQfinish(db->conn);
 		db->conn = NULL;
 	}
+	altpg_mem_unref(db->mem);
+	xfree(db);
 }
 
 static VALUE
@@ -327,18 +738,32 @@ AltPg_Db_s_alloc(VALUE klass)
 {
 	struct AltPg_Db *db = ALLOC(struct AltPg_Db);
 	memset(db, '\0', sizeof(struct AltPg_Db));
+	db->mem = altpg_mem_new();
 	return Data_Wrap_Struct(klass, 0, AltPg_Db_s_free, db);
 }
 
 /* ==== Instance methods ================================================== */
 
+static void *
+altpg_connect_start_nogvl(void *conninfo)
+{
+	return PQconnectStart(conninfo);
+}
+
+static void *
+altpg_connect_poll_nogvl(void *conn)
+{
+	return (void *)(VALUE)PQconnectPoll(conn);
+}
+
 static void
 altpg_db_pq_connect_start(struct AltPg_Db *db, const char *conninfo)
 {
 	if (db->conn)
 		raise_dbi_internal_error("Attempt to re-connect already-connected AltPg::Database object");
 
-	db->conn = PQconnectStart(conninfo);
+	/* PQconnectStart() may resolve host names, so let other threads run */
+	db->conn = altpg_without_gvl(altpg_connect_start_nogvl, (void *)conninfo);
 	if (NULL == db->conn) {
 		raise_dbi_internal_error("PQconnectionStart: unable to allocate libPQ structures");
 	} else if (PQstatus(db->conn) == CONNECTION_BAD) {
@@ -346,17 +771,54 @@ altpg_db_pq_connect_start(struct AltPg_Db *db, const char *conninfo)
 	}
 }
 
+/* The connection's connect_timeout in seconds, as libpq would apply it
+ * to a blocking connect, or 0 for none.  (internal)
+ */
+static int
+altpg_connect_timeout(PGconn *conn)
+{
+	int timeout = 0;
+#ifdef HAVE_PQCONNINFO
+	PQconninfoOption *opts, *o;
+
+	if (NULL == (opts = PQconninfo(conn))) return 0;
+	for (o = opts; o->keyword; ++o) {
+		if (0 == strcmp(o->keyword, "connect_timeout") && o->val) {
+			timeout = atoi(o->val);
+			break;
+		}
+	}
+	PQconninfoFree(opts);
+
+	if (timeout > 0 && timeout < 2) timeout = 2;   /* libpq's minimum */
+#endif
+	return timeout;
+}
+
 static void
 altpg_db_pq_connect_poll(struct AltPg_Db *db)
 {
 	PostgresPollingStatusType pollstat;
-	int fd;
+	int fd, timeout, ready;
+	time_t deadline = 0;
+	struct timeval tv, *tvp = NULL;
 
-	fd = PQsocket(db->conn);
+	/* PQconnectPoll() leaves connect_timeout to us */
+	if ((timeout = altpg_connect_timeout(db->conn)) > 0)
+		deadline = time(NULL) + timeout;
 
 	for (pollstat  = PGRES_POLLING_WRITING;
 	     pollstat != PGRES_POLLING_OK;
-			 pollstat  = PQconnectPoll(db->conn)) {
+			 pollstat  = (PostgresPollingStatusType)(VALUE)
+			             altpg_without_gvl(altpg_connect_poll_nogvl, db->conn)) {
+		fd = PQsocket(db->conn);  /* may change, e.g., on SSL fallback */
+		if (deadline) {
+			tv.tv_sec  = deadline - time(NULL);
+			tv.tv_usec = 0;
+			if (tv.tv_sec <= 0) tv.tv_sec = 0;
+			tvp = &tv;
+		}
+		ready = 1;
 		switch (pollstat) {
 		case PGRES_POLLING_OK:
 			break; /* all done */
@@ -364,14 +826,16 @@ altpg_db_pq_connect_poll(struct AltPg_Db *db)
 			raise_dbi_database_error("PQconnectPoll: bad connection", "08000");
 			break; /* not reached */
 		case PGRES_POLLING_READING:
-			fd_await_readable(fd, NULL);
+			ready = fd_await_readable(fd, tvp);
 			break;
 		case PGRES_POLLING_WRITING:
-			fd_await_writeable(fd, NULL);
+			ready = fd_await_writeable(fd, tvp);
 			break;
 		default:
 			raise_dbi_internal_error("PQconnectPoll: non-sensical PGRES_POLLING status encountered");
 		}
+		if (!ready)
+			raise_dbi_database_error("PQconnectPoll: timeout expired", "08001");
 	}
 }
 
@@ -387,12 +851,16 @@ AltPg_Db_pq_connect_db(VALUE self, VALUE conninfo)
 	 * care of that. */
 	struct AltPg_Db *db;
 
-	Check_SafeStr(conninfo);
+	StringValue(conninfo);
 	Data_Get_Struct(self, struct AltPg_Db, db);
 
-  altpg_db_pq_connect_start(db, RSTRING_PTR(conninfo));
+  altpg_db_pq_connect_start(db, StringValueCStr(conninfo));
 	altpg_db_pq_connect_poll(db);
 
+	/* Never block in PQsend*();  altpg_conn_block() flushes instead */
+	if (PQsetnonblocking(db->conn, 1) != 0)
+		raise_dbi_database_error(PQerrorMessage(db->conn), "08000");
+
 	switch (PQprotocolVersion(db->conn)) {
 	case 3:
 		break;
@@ -433,6 +901,20 @@ altpg_db_simple_exec(struct AltPg_Db *db, const char *query)
 	PQclear(res);
 }
 
+/* Unprepared, parameterized query execution, returning the PGresult which
+ * the caller must PQclear().  (internal)
+ */
+static PGresult *
+altpg_db_exec_params(struct AltPg_Db *db, const char *query, int nparams,
+                     const char * const *values, const int *lengths,
+                     const int *formats, int result_format)
+{
+	if (!PQsendQueryParams(db->conn, query, nparams, NULL,
+	                       values, lengths, formats, result_format))
+		raise_PQsend_error(db->conn);
+	return async_PQgetResult(db->conn);
+}
+
 /* call-seq:
  *   dbh.rollback -> nil
  *
@@ -455,11 +937,11 @@ AltPg_Db_commit(VALUE self)
 }
 
 /* call-seq:
- *   dbh.rollback -> nil
+ *   dbh.pq_rollback -> nil
  *
  * If AutoCommit is false, this method rolls back the current transaction and
  * implicitly begins a new one.  If AutoCommit is true, this method does
- * nothing.
+ * nothing.  Database#rollback wraps it.
  */
 static VALUE
 AltPg_Db_rollback(VALUE self)
@@ -483,7 +965,7 @@ AltPg_Db_dbname(VALUE self)
 	Data_Get_Struct(self, struct AltPg_Db, db);
 
 	/* FIXME - internalerror if NULL == db->conn */
-	return rb_tainted_str_new2(PQdb(db->conn));
+	return rb_str_new2(PQdb(db->conn));
 }
 
 static VALUE
@@ -504,6 +986,104 @@ AltPg_Db_pq_socket(VALUE self)
 	return INT2FIX(PQsocket(db->conn));
 }
 
+/* call-seq:
+ *   db.pq_result_memory -> [ current, peak ]
+ *
+ * Bytes of PGresult memory now held by this connection's statements, and
+ * the most ever held at once.
+ */
+static VALUE
+AltPg_Db_pq_result_memory(VALUE self)
+{
+	struct AltPg_Db *db;
+
+	Data_Get_Struct(self, struct AltPg_Db, db);
+	return rb_assoc_new(SIZET2NUM(db->mem->current), SIZET2NUM(db->mem->peak));
+}
+
+/* Restart the high-water mark from the memory now held.  (internal) */
+static VALUE
+AltPg_Db_pq_result_memory_reset(VALUE self)
+{
+	struct AltPg_Db *db;
+
+	Data_Get_Struct(self, struct AltPg_Db, db);
+	db->mem->peak = db->mem->current;
+	return Qnil;
+}
+
+/* call-seq:
+ *   db.pq_select_timed(sql, timeout) -> [ value, ... ] or nil
+ *
+ * Run +sql+, which may be several statements, returning the first row of
+ * its last result as text.  Should the server not answer within +timeout+
+ * seconds, raise DBI::DatabaseError (57014) without cancelling:  the
+ * command is left running, and the connection should be discarded.
+ */
+static VALUE
+AltPg_Db_pq_select_timed(VALUE self, VALUE sql, VALUE timeout)
+{
+	struct AltPg_Db *db;
+	struct altpg_consume c;
+	struct timeval patience, tv;
+	time_t deadline;
+	PGresult *res, *err = NULL;
+	VALUE row = Qnil;
+	int fd, flushing, i;
+
+	Data_Get_Struct(self, struct AltPg_Db, db);
+	patience = rb_time_interval(timeout);
+	deadline = time(NULL) + patience.tv_sec + (patience.tv_usec > 0);
+
+	if (!PQsendQuery(db->conn, StringValueCStr(sql)))
+		raise_PQsend_error(db->conn);
+
+	fd = PQsocket(db->conn);
+	c.conn = db->conn;
+	for (;;) {
+		if ((flushing = PQflush(db->conn)) < 0)
+			raise_dbi_database_error(PQerrorMessage(db->conn), "08000");
+		altpg_without_gvl(altpg_consume_input_nogvl, &c);
+		if (!c.ok)
+			raise_dbi_database_error(PQerrorMessage(db->conn), "08000");
+
+		if (!c.busy) {
+			if (NULL == (res = PQgetResult(db->conn))) break;
+			switch (PQresultStatus(res)) {
+			case PGRES_TUPLES_OK:
+				row = Qnil;
+				if (PQntuples(res) > 0) {
+					row = rb_ary_new2(PQnfields(res));
+					for (i = 0; i < PQnfields(res); ++i) {
+						rb_ary_store(row, i, PQgetisnull(res, 0, i) ? Qnil
+						             : rb_str_new2(PQgetvalue(res, 0, i)));
+					}
+				}
+				PQclear(res);
+				break;
+			case PGRES_COMMAND_OK:
+				PQclear(res);
+				break;
+			default:                   /* raise once the connection is idle */
+				if (err) PQclear(err);
+				err = res;
+			}
+			continue;
+		}
+
+		if ((tv.tv_sec = deadline - time(NULL)) <= 0) {
+			if (err) PQclear(err);
+			raise_dbi_database_error("Query timeout expired", "57014");
+		}
+		tv.tv_usec = 0;
+		altpg_wait_fd(fd, ALTPG_WAIT_READABLE
+		                  | (flushing ? ALTPG_WAIT_WRITEABLE : 0), &tv);
+	}
+	if (err) raise_PQresult_error(err);
+
+	return row;
+}
+
 /* call-seq:
  *  db.pq_notifies(timeout) -> [notify, pid] or nil
  *  db.pq_notifies(timeout) { |notify, pid| block }
@@ -516,8 +1096,6 @@ AltPg_Db_pq_socket(VALUE self)
 static VALUE
 AltPg_Db_pq_notifies(VALUE self, VALUE timeout)
 {
-	extern struct timeval rb_time_interval(VALUE);
-
 	struct AltPg_Db *db;
 	struct pgNotify *notification;
 	VALUE ary;
@@ -551,33 +1129,388 @@ AltPg_Db_pq_notifies(VALUE self, VALUE timeout)
 	return Qnil;
 }
 
-/* ---------- DBI::DBD::Pq::Statement ------------------------------------- */
+/* ---------- Large Objects ----------------------------------------------- */
 
-static void
-AltPg_St_s_free(struct AltPg_St *st)
-{
-	if (NULL == st) return;
-	if (st->res) PQclear(st->res);
-	altpg_params_clear(&st->params);
-	xfree(st);
-}
+/* We deliberately avoid libpq's lo_*() family, which blocks the whole
+ * process in PQfn().  The server-side functions of the same names are
+ * instead invoked through the ordinary (async) extended query path.
+ *
+ * N.B.:  large object descriptors are only valid within a transaction.
+ */
 
-static VALUE
-AltPg_St_s_alloc(VALUE klass)
-{
-	struct AltPg_St *st = ALLOC(struct AltPg_St);
-	MEMZERO(st, struct AltPg_St, 1);
-	return Data_Wrap_Struct(klass, 0, AltPg_St_s_free, st);
-}
+#define ALTPG_LO_MAXARGS 3
 
-/* FIXME:  paramTypes ? */
+/* call-seq:
+ *   db.pq_lo_int(query, args) -> integer or nil
+ *
+ * Run a large object +query+, e.g., "SELECT pg_catalog.lo_open($1, $2)",
+ * with up to three integral +args+, returning the integral result.
+ */
 static VALUE
-AltPg_St_initialize(VALUE self, VALUE parent, VALUE query, VALUE param_count, VALUE preparable)
+AltPg_Db_pq_lo_int(VALUE self, VALUE query, VALUE args)
 {
 	struct AltPg_Db *db;
-	struct AltPg_St *st;
-	VALUE plan;
-	int nparams;
+	const char *values[ALTPG_LO_MAXARGS];
+	VALUE strs[ALTPG_LO_MAXARGS];
+	PGresult *res;
+	VALUE ret;
+	int nargs, i;
+
+	Data_Get_Struct(self, struct AltPg_Db, db);
+	StringValue(query);
+	Check_Type(args, T_ARRAY);
+
+	nargs = (int)RARRAY_LEN(args);
+	if (nargs > ALTPG_LO_MAXARGS)
+		raise_dbi_internal_error("Too many large object function arguments");
+
+	for (i = 0; i < nargs; ++i) {
+		strs[i] = rb_obj_as_string(rb_Integer(rb_ary_entry(args, i)));
+		values[i] = StringValueCStr(strs[i]);
+	}
+
+	res = altpg_db_exec_params(db, StringValueCStr(query), nargs,
+	                           values, NULL, NULL, 0);
+	ret = (PQntuples(res) < 1 || PQgetisnull(res, 0, 0))
+	      ? Qnil
+	      : rb_cstr2inum(PQgetvalue(res, 0, 0), 10);
+	PQclear(res);
+	RB_GC_GUARD(args);
+
+	return ret;
+}
+
+/* call-seq:
+ *   db.pq_lo_read(fd, len, buf) -> buf or nil
+ *
+ * Read up to +len+ bytes from large object descriptor +fd+, replacing the
+ * contents of String +buf+.  Returns +nil+ at end-of-object, like IO#read.
+ */
+static VALUE
+AltPg_Db_pq_lo_read(VALUE self, VALUE fd, VALUE len, VALUE buf)
+{
+	struct AltPg_Db *db;
+	const char *values[2];
+	VALUE s_fd, s_len;
+	PGresult *res;
+	int nread;
+
+	Data_Get_Struct(self, struct AltPg_Db, db);
+	StringValue(buf);
+	rb_str_modify(buf);
+
+	if (NUM2INT(len) <= 0)
+		rb_raise(rb_eArgError, "large object read length must be positive");
+
+	s_fd  = rb_obj_as_string(rb_Integer(fd));
+	s_len = rb_obj_as_string(rb_Integer(len));
+	values[0] = StringValueCStr(s_fd);
+	values[1] = StringValueCStr(s_len);
+
+	/* binary result format:  the bytea arrives unescaped */
+	res = altpg_db_exec_params(db, "SELECT pg_catalog.loread($1, $2)", 2,
+	                           values, NULL, NULL, 1);
+	nread = PQgetisnull(res, 0, 0) ? 0 : PQgetlength(res, 0, 0);
+
+	rb_str_resize(buf, nread);
+	if (nread > 0)
+		memcpy(RSTRING_PTR(buf), PQgetvalue(res, 0, 0), nread);
+	PQclear(res);
+#ifdef HAVE_RUBY_ENCODING_H
+	rb_enc_associate(buf, rb_ascii8bit_encoding());  /* as IO#read(len, buf) */
+#endif
+
+	return nread > 0 ? buf : Qnil;
+}
+
+/* call-seq:
+ *   db.pq_lo_write(fd, data) -> integer
+ *
+ * Write String +data+ to large object descriptor +fd+, returning the
+ * number of bytes written.
+ */
+static VALUE
+AltPg_Db_pq_lo_write(VALUE self, VALUE fd, VALUE data)
+{
+	struct AltPg_Db *db;
+	const char *values[2];
+	int lengths[2];
+	int formats[2] = { 0, 1 }; /* fd as text, data as raw bytea */
+	VALUE s_fd;
+	PGresult *res;
+	VALUE ret;
+
+	Data_Get_Struct(self, struct AltPg_Db, db);
+	StringValue(data);
+
+	s_fd = rb_obj_as_string(rb_Integer(fd));
+	values[0]  = StringValueCStr(s_fd);
+	lengths[0] = 0;
+	values[1]  = RSTRING_PTR(data);
+	lengths[1] = (int)RSTRING_LEN(data);
+
+	res = altpg_db_exec_params(db, "SELECT pg_catalog.lowrite($1, $2)", 2,
+	                           values, lengths, formats, 0);
+	ret = rb_cstr2inum(PQgetvalue(res, 0, 0), 10);
+	PQclear(res);
+	RB_GC_GUARD(data);
+
+	return ret;
+}
+
+/* ---------- Batches ----------------------------------------------------- */
+
+struct altpg_batch {
+	VALUE counts;      /* Array of per-statement row counts (or nils)  */
+	int failed;        /* index of the first failed statement, or -1   */
+	VALUE err_msg;
+	VALUE err_state;
+};
+
+static VALUE
+altpg_cmd_tuples(PGresult *res)
+{
+	char *rows = PQcmdTuples(res);
+
+	return rows[0] ? rb_cstr2inum(rows, 10) : Qnil;
+}
+
+/* Record one statement's result into +batch+.  A statement's outcome is
+ * recorded only once, even if (e.g., for COPY) several PGresults arrive.
+ * (internal)
+ */
+static void
+altpg_batch_record(struct altpg_batch *batch, PGconn *conn, PGresult *res,
+                   int index)
+{
+	switch (PQresultStatus(res)) {
+	case PGRES_COPY_IN:
+		/* We have no data to send, so refuse.  The server then errors. */
+		PQputCopyEnd(conn, "COPY FROM STDIN is not supported in a batch");
+		return;
+	case PGRES_COPY_OUT:
+		{
+			char *buf;
+
+			/* Discard the COPY data, honoring our wait loop */
+			for (;;) {
+				int n = PQgetCopyData(conn, &buf, 1);
+				if (n > 0) {
+					PQfreemem(buf);
+				} else if (n == 0) {
+					fd_await_readable(PQsocket(conn), NULL);
+					PQconsumeInput(conn);
+				} else {
+					break;
+				}
+			}
+		}
+		/* The COPY's own completion result follows */
+		return;
+	case PGRES_TUPLES_OK:
+	case PGRES_EMPTY_QUERY:
+	case PGRES_COMMAND_OK:
+		if (RARRAY_LEN(batch->counts) <= index)
+			rb_ary_store(batch->counts, index, altpg_cmd_tuples(res));
+		break;
+	case PGRES_BAD_RESPONSE:
+	case PGRES_FATAL_ERROR:
+	case PGRES_NONFATAL_ERROR:
+		if (batch->failed < 0) {
+			char *state = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+
+			batch->failed    = index;
+			batch->err_msg   = rb_str_new2(PQresultErrorMessage(res));
+			batch->err_state = state ? rb_str_new2(state) : Qnil;
+		}
+		break;
+	default:
+		/* e.g., PGRES_PIPELINE_ABORTED:  a statement after the failure */
+		break;
+	}
+}
+
+/* Raise a DBI::DatabaseError naming the failed statement, if any.  The
+ * error's +err+ is the zero-based index of that statement.  (internal)
+ */
+static VALUE
+altpg_batch_finish(struct altpg_batch *batch)
+{
+	VALUE args[3];
+
+	if (batch->failed < 0) return batch->counts;
+
+	args[0] = rb_str_new2("");
+	rb_str_catf(args[0], "batch statement %d: ", batch->failed);
+	rb_str_append(args[0], batch->err_msg);
+	args[1] = INT2FIX(batch->failed);
+	args[2] = batch->err_state;
+
+	rb_exc_raise(rb_class_new_instance(3, args,
+	                                   rb_path2class("DBI::DatabaseError")));
+	return Qnil; /* Not reached */
+}
+
+/* call-seq:
+ *   db.pq_exec_batch(sql, count) -> [ rows, ... ]
+ *
+ * Send +count+ unparameterized, semicolon-separated statements in a single
+ * simple protocol Query message, collecting every statement's result.
+ */
+static VALUE
+AltPg_Db_pq_exec_batch(VALUE self, VALUE sql, VALUE count)
+{
+	struct AltPg_Db *db;
+	struct altpg_batch batch;
+	PGresult *res;
+	int index = 0;
+
+	Data_Get_Struct(self, struct AltPg_Db, db);
+	StringValue(sql);
+
+	batch.counts    = rb_ary_new2(NUM2INT(count));
+	batch.failed    = -1;
+	batch.err_msg   = Qnil;
+	batch.err_state = Qnil;
+
+	if (!PQsendQuery(db->conn, StringValueCStr(sql)))
+		raise_PQsend_error(db->conn);
+
+	for (;;) {
+		altpg_conn_block(db->conn);
+		if (NULL == (res = altpg_get_result(db->conn))) break;
+
+		altpg_batch_record(&batch, db->conn, res, index);
+		if (RARRAY_LEN(batch.counts) > index || batch.failed == index)
+			++index;
+		PQclear(res);
+	}
+
+	if (batch.failed < 0 && index != NUM2INT(count)) {
+		rb_raise(rb_path2class("DBI::ProgrammingError"),
+		         "Batch of %d statements returned %d results", NUM2INT(count), index);
+	}
+
+	return altpg_batch_finish(&batch);
+}
+
+#ifdef LIBPQ_HAS_PIPELINING
+/* call-seq:
+ *   db.pq_exec_pipeline([ [sql, params], ... ]) -> [ rows, ... ]
+ *
+ * Send each (possibly parameterized) statement through the extended
+ * protocol in pipeline mode, followed by a single Sync, then collect every
+ * statement's result.  +params+ are as for AltPg::Statement#execute.
+ */
+static VALUE
+AltPg_Db_pq_exec_pipeline(VALUE self, VALUE stmts)
+{
+	struct AltPg_Db *db;
+	struct altpg_batch batch;
+	PGresult *res;
+	int nsent, index;
+	VALUE send_err = Qnil;
+
+	Data_Get_Struct(self, struct AltPg_Db, db);
+	Check_Type(stmts, T_ARRAY);
+
+	batch.counts    = rb_ary_new2(RARRAY_LEN(stmts));
+	batch.failed    = -1;
+	batch.err_msg   = Qnil;
+	batch.err_state = Qnil;
+
+	if (!PQenterPipelineMode(db->conn))
+		raise_PQsend_error(db->conn);
+
+	for (nsent = 0; nsent < RARRAY_LEN(stmts); ++nsent) {
+		VALUE stmt   = rb_ary_entry(stmts, nsent);
+		VALUE sql    = rb_ary_entry(stmt, 0);
+		VALUE params = rb_ary_entry(stmt, 1);
+		struct altpg_params ap;
+		int send_ok;
+
+		MEMZERO(&ap, struct altpg_params, 1);
+		if (RARRAY_LEN(params) > 0) {
+			altpg_params_initialize(&ap, (int)RARRAY_LEN(params));
+			altpg_params_from_ary(&ap, params);
+		}
+		send_ok = PQsendQueryParams(db->conn, RSTRING_PTR(sql), ap.nparams,
+		                            ap.param_types,
+		                            (const char * const *)ap.param_values,
+		                            ap.param_lengths, ap.param_formats, 1);
+		altpg_params_clear(&ap);
+
+		if (!send_ok) {
+			send_err = rb_str_new2(PQerrorMessage(db->conn));
+			break;
+		}
+	}
+
+	if (!PQpipelineSync(db->conn)) {
+		/* The connection is unusable, but leave it tidy */
+		PQexitPipelineMode(db->conn);
+		raise_PQsend_error(db->conn);
+	}
+
+	/* Each statement's results are terminated by a NULL, and the
+	 * whole pipeline by PGRES_PIPELINE_SYNC
+	 */
+	index = 0;
+	for (;;) {
+		altpg_conn_block(db->conn);
+		res = altpg_get_result(db->conn);
+		if (NULL == res) {
+			++index;
+			continue;
+		}
+		if (PQresultStatus(res) == PGRES_PIPELINE_SYNC) {
+			PQclear(res);
+			break;
+		}
+		altpg_batch_record(&batch, db->conn, res, index);
+		PQclear(res);
+	}
+
+	PQexitPipelineMode(db->conn);
+	RB_GC_GUARD(stmts);
+
+	if (batch.failed < 0 && !NIL_P(send_err)) {
+		batch.failed  = nsent;
+		batch.err_msg = send_err;
+	}
+
+	return altpg_batch_finish(&batch);
+}
+#endif /* LIBPQ_HAS_PIPELINING */
+
+/* ---------- DBI::DBD::Pq::Statement ------------------------------------- */
+
+static void
+AltPg_St_s_free(struct AltPg_St *st)
+{
+	if (NULL == st) return;
+	altpg_mem_release(st->mem, &st->res, &st->res_size);
+	altpg_mem_release(st->mem, &st->desc, &st->desc_size);
+	altpg_mem_unref(st->mem);
+	altpg_params_clear(&st->params);
+	xfree(st);
+}
+
+static VALUE
+AltPg_St_s_alloc(VALUE klass)
+{
+	struct AltPg_St *st = ALLOC(struct AltPg_St);
+	MEMZERO(st, struct AltPg_St, 1);
+	return Data_Wrap_Struct(klass, 0, AltPg_St_s_free, st);
+}
+
+static VALUE
+AltPg_St_initialize(VALUE self, VALUE parent, VALUE query, VALUE param_count, VALUE preparable)
+{
+	struct AltPg_Db *db;
+	struct AltPg_St *st;
+	VALUE plan;
+	int nparams;
 
 	Data_Get_Struct(self, struct AltPg_St, st); /* later, our own data_get */
 
@@ -591,8 +1524,9 @@ AltPg_St_initialize(VALUE self, VALUE parent, VALUE query, VALUE param_count, VA
 		         "Attempt to create AltPg::Statement from invalid AltPg::Database (db %p, db->conn %p)", db, db ? db->conn : NULL);
 	}
 	st->conn = db->conn;
+	if (!st->mem) st->mem = altpg_mem_ref(db->mem);
 
-	SafeStringValue(query);
+	StringValue(query);
 	rb_iv_set(self, "@query", query);
 
 	nparams = NUM2INT(param_count);
@@ -605,8 +1539,10 @@ AltPg_St_initialize(VALUE self, VALUE parent, VALUE query, VALUE param_count, VA
 	rb_str_append(plan, rb_obj_as_string(ULONG2NUM(db->serial++)));
 	rb_iv_set(self, "@plan", plan);
 
+	rb_iv_set(self, "@parent", parent);  /* keeps st->conn from PQfinish() by GC */
 	rb_iv_set(self, "@type_map", rb_iv_get(parent, "@type_map"));
 	rb_iv_set(self, "@params", rb_ary_new());
+	rb_iv_set(self, "@param_count", INT2FIX(nparams));
 
 	return self;
 }
@@ -623,54 +1559,293 @@ AltPg_St_cancel(VALUE self)
 	return Qnil;
 }
 
+/* DEALLOCATE our prepared statement, if any.  (internal) */
+static void
+altpg_st_deallocate(VALUE self, struct AltPg_St *st)
+{
+	VALUE plan = rb_iv_get(self, "@plan");
+	VALUE deallocate_fmt = rb_str_new2("DEALLOCATE \"%s\"");
+	VALUE deallocate = rb_str_format(1, &plan, deallocate_fmt);
+	PGresult *res;
+
+	if (!st->conn || !st->prepared) return;
+
+	if (!PQsendQuery(st->conn, StringValueCStr(deallocate))) {
+		raise_PQsend_error(st->conn);
+	}
+	res = async_PQgetResult(st->conn);
+	PQclear(res);
+	st->prepared = 0;
+
+	altpg_mem_release(st->mem, &st->desc, &st->desc_size);
+}
+
+/* Prepare and perhaps describe, as pq_prepare() below.  (internal) */
+struct altpg_prepare {
+	struct AltPg_St *st;
+	const char *plan;
+	const char *query;
+	int describe;              /* non-zero to DESCRIBE, too              */
+	int savepoint;             /* non-zero to guard with a SAVEPOINT     */
+	PGresult *err;             /* first failure, until raised            */
+	PGresult *desc;            /* description, until kept by +st+        */
+};
+
+#define ALTPG_PREPARE_SAVEPOINT "altpg_prepare"
+
+static void
+altpg_st_simple_exec(struct AltPg_St *st, const char *query)
+{
+	if (!PQsendQuery(st->conn, query))
+		raise_PQsend_error(st->conn);
+	PQclear(async_PQgetResult(st->conn));
+}
+
 static VALUE
-AltPg_St_execute(VALUE self)
+altpg_st_prepare_body(VALUE arg)
+{
+	struct altpg_prepare *p = (struct altpg_prepare *)arg;
+	struct AltPg_St *st = p->st;
+	PGconn *conn = st->conn;
+	int nparams = st->params.nparams;
+	const Oid *types = st->params.param_types;
+
+#ifdef LIBPQ_HAS_PIPELINING
+	/* One round trip:  [SAVEPOINT,] Parse, [Describe, RELEASE,] Sync */
+	PGresult *res;
+	int ok, cmd, prepare_cmd, describe_cmd;
+
+	if (!PQenterPipelineMode(conn))
+		raise_PQsend_error(conn);
+
+	prepare_cmd  = p->savepoint ? 1 : 0;
+	describe_cmd = p->describe ? prepare_cmd + 1 : -1;
+
+	ok = (!p->savepoint ||
+	      PQsendQueryParams(conn, "SAVEPOINT " ALTPG_PREPARE_SAVEPOINT,
+	                        0, NULL, NULL, NULL, NULL, 0))
+	  && PQsendPrepare(conn, p->plan, p->query, nparams, types)
+	  && (!p->describe || PQsendDescribePrepared(conn, p->plan))
+	  && (!p->savepoint ||
+	      PQsendQueryParams(conn, "RELEASE SAVEPOINT " ALTPG_PREPARE_SAVEPOINT,
+	                        0, NULL, NULL, NULL, NULL, 0))
+	  && PQpipelineSync(conn);
+	if (!ok) {
+		VALUE msg = rb_str_new2(PQerrorMessage(conn));
+
+		altpg_conn_abandon(conn);
+		raise_dbi_database_error(StringValueCStr(msg), "08000");
+	}
+
+	/* Each command's results end with a NULL, the pipeline's with a Sync */
+	for (cmd = 0;;) {
+		altpg_conn_block(conn);
+		if (NULL == (res = altpg_get_result(conn))) {
+			++cmd;
+			continue;
+		}
+		switch (PQresultStatus(res)) {
+		case PGRES_PIPELINE_SYNC:
+			PQclear(res);
+			break;
+		case PGRES_COMMAND_OK:
+			if (cmd == prepare_cmd) st->prepared = 1;
+			if (cmd == describe_cmd) {
+				p->desc = res;
+				continue;
+			}
+			PQclear(res);
+			continue;
+		case PGRES_BAD_RESPONSE:
+		case PGRES_FATAL_ERROR:
+		case PGRES_NONFATAL_ERROR:
+			if (!p->err) {
+				p->err = res;
+				continue;
+			}
+			/* FALLTHROUGH */
+		default:
+			PQclear(res);
+			continue;
+		}
+		break;
+	}
+	PQexitPipelineMode(conn);
+
+	if (p->err) {
+		res = p->err;
+		p->err = NULL;
+		raise_PQresult_error(res);
+	}
+#else
+	if (p->savepoint)
+		altpg_st_simple_exec(st, "SAVEPOINT " ALTPG_PREPARE_SAVEPOINT);
+
+	if (!PQsendPrepare(conn, p->plan, p->query, nparams, types))
+		raise_PQsend_error(conn);
+	PQclear(async_PQgetResult(conn));
+	st->prepared = 1;
+
+	if (p->describe) {
+		if (!PQsendDescribePrepared(conn, p->plan))
+			raise_PQsend_error(conn);
+		p->desc = async_PQgetResult(conn);
+	}
+
+	if (p->savepoint)
+		altpg_st_simple_exec(st, "RELEASE SAVEPOINT " ALTPG_PREPARE_SAVEPOINT);
+#endif
+
+	return Qnil;
+}
+
+/* Undo a failed, savepoint-guarded prepare.  (internal) */
+static VALUE
+altpg_st_prepare_rollback(VALUE arg)
+{
+	altpg_st_simple_exec((struct AltPg_St *)arg,
+	                     "ROLLBACK TO SAVEPOINT " ALTPG_PREPARE_SAVEPOINT ";"
+	                     "RELEASE SAVEPOINT " ALTPG_PREPARE_SAVEPOINT);
+	return Qnil;
+}
+
+/* The parameter types of a described statement.  (internal) */
+static VALUE
+altpg_st_param_types(struct AltPg_St *st)
+{
+	VALUE ret = rb_ary_new2(PQnparams(st->desc));
+	int i;
+
+	for (i = 0; i < PQnparams(st->desc); ++i) {
+		rb_ary_store(ret, i, UINT2NUM(PQparamtype(st->desc, i)));
+	}
+	return ret;
+}
+
+/* DESCRIBE our prepared statement, if not yet done.  (internal) */
+static void
+altpg_st_describe(VALUE self, struct AltPg_St *st)
+{
+	if (st->desc || !st->prepared) return;
+
+	if (!PQsendDescribePrepared(st->conn, RSTRING_PTR(rb_iv_get(self, "@plan"))))
+		raise_PQsend_error(st->conn);
+	st->desc = async_PQgetResult(st->conn);
+	st->desc_size = altpg_mem_charge(st->mem, st->desc);
+}
+
+/* call-seq:
+ *   sth.pq_prepare(param_types, describe) -> [ oid, ... ] or nil
+ *
+ * PREPARE the statement, (re-)preparing if need be, with the given
+ * parameter type Oids (0 or nil to let the server infer the type).  If
+ * +describe+ is true, DESCRIBE it in the same round trip, where libpq
+ * supports pipelining, and return the parameter types the server settled
+ * on.  Otherwise the statement is described only should column_info need
+ * it.
+ *
+ * Within a transaction, a prepare leaving types to the server is guarded
+ * by a savepoint, so that its failure leaves the transaction usable.
+ */
+static VALUE
+AltPg_St_pq_prepare(VALUE self, VALUE param_types, VALUE describe)
 {
 	struct AltPg_St *st;
-	VALUE iv_params;
-	VALUE iv_plan;
-	int send_ok;
+	struct altpg_prepare p;
+	VALUE iv_plan, iv_query;
+	int i, state = 0;
 
 	st = altpg_st_get_unfinished(self);
 	altpg_st_cancel(st);
+	altpg_st_deallocate(self, st);
+
+	iv_plan  = rb_iv_get(self, "@plan");
+	iv_query = rb_iv_get(self, "@query");
+
+	MEMZERO(&p, struct altpg_prepare, 1);
+	p.st       = st;
+	p.plan     = RSTRING_PTR(iv_plan);
+	p.query    = RSTRING_PTR(iv_query);
+	p.describe = RTEST(describe);
+
+	for (i = 0; i < st->params.nparams; ++i) {
+		VALUE oid = rb_ary_entry(param_types, i);
+		st->params.param_types[i] = NIL_P(oid) ? (Oid)0 : (Oid)NUM2UINT(oid);
+		if (st->params.param_types[i] == 0 &&
+		    PQtransactionStatus(st->conn) == PQTRANS_INTRANS) {
+			p.savepoint = 1;
+		}
+	}
 
-	iv_params = rb_iv_get(self, "@params");
-	iv_plan   = rb_iv_get(self, "@plan");
+	rb_protect(altpg_st_prepare_body, (VALUE)&p, &state);
+	if (state) {
+		if (p.err) PQclear(p.err);
+		if (p.desc) PQclear(p.desc);
+		if (p.savepoint && PQtransactionStatus(st->conn) == PQTRANS_INERROR) {
+			int ignored = 0;
+			rb_protect(altpg_st_prepare_rollback, (VALUE)st, &ignored);
+		}
+		rb_jump_tag(state);
+	}
+	RB_GC_GUARD(iv_plan);
+	RB_GC_GUARD(iv_query);
 
-	if (RARRAY_LEN(iv_params) != st->params.nparams) {
-		int nsupplied = (int)RARRAY_LEN(iv_params);
-		/* Let's be charitable and give the user an opportunity to recover.
-		 * Presently in the DBI, there's no way to clear bound parameters.
-		 */
-		rb_ary_clear(iv_params);
-		rb_raise(rb_path2class("DBI::ProgrammingError"),
-		                       "%d parameters supplied, but prepared statement \"%s\" requires %d",
-		                       nsupplied,
-		                       RSTRING_PTR(iv_plan),
-		                       st->params.nparams);
+	if (!p.desc) return Qnil;
+
+	st->desc = p.desc;
+	st->desc_size = altpg_mem_charge(st->mem, st->desc);
+	return altpg_st_param_types(st);
+}
+
+/* call-seq:
+ *   sth.pq_describe -> [ oid, ... ]
+ *
+ * DESCRIBE the prepared statement, if not yet done, returning its
+ * parameter types.
+ */
+static VALUE
+AltPg_St_pq_describe(VALUE self)
+{
+	struct AltPg_St *st;
+
+	st = altpg_st_get_unfinished(self);
+	if (!st->prepared) {
+		raise_dbi_internal_error("Attempt to describe unprepared statement");
 	}
+	altpg_st_describe(self, st);
 
-	altpg_params_from_ary(&st->params, iv_params);
+	return altpg_st_param_types(st);
+}
 
-	if (! st->prepared) {
-		PGresult *res;
+/* call-seq:
+ *   sth.pq_execute(params) -> nil
+ *
+ * Execute the prepared statement with +params+, an Array of
+ * [ value, oid, format ] triples encoded for the described parameter
+ * types.
+ */
+static VALUE
+AltPg_St_pq_execute(VALUE self, VALUE params)
+{
+	struct AltPg_St *st;
+	VALUE iv_plan;
+	int send_ok;
 
-		if (!PQsendPrepare(st->conn,
-					RSTRING_PTR(iv_plan),
-					RSTRING_PTR(rb_iv_get(self, "@query")),
-					st->params.nparams,
-					st->params.param_types)) {
-			raise_PQsend_error(st->conn);
-		}
-		res = async_PQgetResult(st->conn);
-		PQclear(res);
-		st->prepared = 1;
+	st = altpg_st_get_unfinished(self);
+	altpg_st_cancel(st);
+	st->cmd_tuples[0] = '\0';
+
+	if (! st->prepared) {
+		raise_dbi_internal_error("Attempt to execute unprepared statement");
 	}
 
+	iv_plan = rb_iv_get(self, "@plan");
+	altpg_params_from_ary(&st->params, params);
+
 	send_ok = PQsendQueryPrepared(st->conn,
 	                              RSTRING_PTR(iv_plan),
 	                              st->params.nparams,
-	                              st->params.param_values,
+	                              (const char * const *)st->params.param_values,
 	                              st->params.param_lengths,
 	                              st->params.param_formats,
 	                              1);
@@ -679,8 +1854,11 @@ AltPg_St_execute(VALUE self)
 			raise_PQsend_error(st->conn);
 	}
 	st->res = async_PQgetResult(st->conn);
+	st->res_size = altpg_mem_charge(st->mem, st->res);
 	st->nfields = PQnfields(st->res);
 	st->ntuples = PQntuples(st->res);
+	strncpy(st->cmd_tuples, PQcmdTuples(st->res), sizeof(st->cmd_tuples) - 1);
+	RB_GC_GUARD(params);
 
 	return Qnil;
 }
@@ -693,18 +1871,8 @@ AltPg_St_finish(VALUE self)
 	st = altpg_st_get_unfinished(self);
 
 	altpg_st_cancel(st);
-
-	if (st->conn && st->prepared) {
-		VALUE plan = rb_iv_get(self, "@plan");
-		VALUE deallocate_fmt = rb_str_new2("DEALLOCATE \"%s\"");
-		PGresult *res;
-
-		if (!PQsendQuery(st->conn, STR2CSTR(rb_str_format(1, &plan, deallocate_fmt)))) {
-			raise_PQsend_error(st->conn);
-		}
-		res = async_PQgetResult(st->conn);
-		PQclear(res);
-	}
+	altpg_st_deallocate(self, st);
+	st->cmd_tuples[0] = '\0';
 
 	return Qnil;
 }
@@ -720,6 +1888,7 @@ AltPg_St_fetch(VALUE self)
 	st = altpg_st_get_unfinished(self);
 
 	if (!st->res || st->row_number >= st->ntuples) {
+		altpg_st_release_result(st);
 		return Qnil;
 	}
 
@@ -735,7 +1904,122 @@ AltPg_St_fetch(VALUE self)
 		rb_ary_store(ret, i, val);
 	}
 
-	st->row_number++;
+	/* Don't hold a consumed result until the next execute() or GC */
+	if (++st->row_number >= st->ntuples) {
+		altpg_st_release_result(st);
+	}
+	return ret;
+}
+
+/* Width of a type we can pack column-wise, or zero.  (internal) */
+static int
+altpg_packable_width(Oid type_oid)
+{
+	switch (type_oid) {
+	case ALTPG_BOOLOID:
+		return 1;
+	case ALTPG_INT2OID:
+		return 2;
+	case ALTPG_INT4OID:
+	case ALTPG_FLOAT4OID:
+	case ALTPG_DATEOID:
+		return 4;
+	case ALTPG_INT8OID:
+	case ALTPG_FLOAT8OID:
+	case ALTPG_TIMESTAMPOID:
+	case ALTPG_TIMESTAMPTZOID:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+/* Copy a big-endian (network order) value of +width+ bytes from +src+ to
+ * +dst+ in native byte order.  Floats are moved as their bit patterns.
+ */
+static void
+altpg_unpack_big(char *dst, const unsigned char *src, int width)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 0; i < width; ++i)
+		v = (v << 8) | src[i];
+
+	switch (width) {
+	case 1: { uint8_t  n = (uint8_t)v;  memcpy(dst, &n, 1); break; }
+	case 2: { uint16_t n = (uint16_t)v; memcpy(dst, &n, 2); break; }
+	case 4: { uint32_t n = (uint32_t)v; memcpy(dst, &n, 4); break; }
+	case 8: { memcpy(dst, &v, 8); break; }
+	}
+}
+
+/* call-seq:
+ *   sth.pq_fetch_columns -> [ [data, nulls], ... ] or nil
+ *
+ * Fetch all remaining rows column-wise.  Fixed-width binary columns come
+ * back as a String of packed, native-endian values and a String bitmap in
+ * which bit (i % 8) of byte (i / 8) is set iff row i is NULL.  NULL slots
+ * are zero-filled.  Any other column comes back as an Array of raw values
+ * (or nils), and a +nil+ bitmap.
+ */
+static VALUE
+AltPg_St_pq_fetch_columns(VALUE self)
+{
+	struct AltPg_St *st;
+	VALUE ret;
+	int nrows, row0;
+	int i, r;
+
+	st = altpg_st_get_unfinished(self);
+
+	if (!st->res) return Qnil;
+
+	row0  = st->row_number;
+	nrows = st->ntuples > st->row_number ? st->ntuples - st->row_number : 0;
+	ret   = rb_ary_new2(st->nfields);
+
+	for (i = 0; i < (int)st->nfields; ++i) {
+		int width = altpg_packable_width(PQftype(st->res, i));
+		VALUE pair;
+
+		if (width > 0 && PQfformat(st->res, i) == 1) {
+			VALUE data  = rb_str_new(NULL, (long)nrows * width);
+			VALUE nulls = rb_str_new(NULL, (nrows + 7) / 8);
+			char *dp = RSTRING_PTR(data);
+			char *np = RSTRING_PTR(nulls);
+
+			memset(np, 0, RSTRING_LEN(nulls));
+			for (r = 0; r < nrows; ++r, dp += width) {
+				if (PQgetisnull(st->res, row0 + r, i)) {
+					memset(dp, 0, width);
+					np[r / 8] |= 1 << (r % 8);
+					continue;
+				}
+				if (PQgetlength(st->res, row0 + r, i) != width)
+					raise_dbi_internal_error("Unexpected length for fixed-width pg type");
+				altpg_unpack_big(dp,
+				                 (unsigned char *)PQgetvalue(st->res, row0 + r, i),
+				                 width);
+			}
+			pair = rb_assoc_new(data, nulls);
+		} else {
+			VALUE values = rb_ary_new2(nrows);
+
+			for (r = 0; r < nrows; ++r) {
+				rb_ary_store(values, r,
+				             PQgetisnull(st->res, row0 + r, i)
+				             ? Qnil
+				             : rb_str_new(PQgetvalue(st->res, row0 + r, i),
+				                          PQgetlength(st->res, row0 + r, i)));
+			}
+			pair = rb_assoc_new(values, Qnil);
+		}
+		rb_ary_store(ret, i, pair);
+	}
+
+	st->row_number = st->ntuples;
+	altpg_st_release_result(st);
 	return ret;
 }
 
@@ -743,12 +2027,10 @@ static VALUE
 AltPg_St_rows(VALUE self)
 {
 	struct AltPg_St *st;
-	char *rows;
 
 	st = altpg_st_get_unfinished(self);
-	rows = PQcmdTuples(st->res);
 
-	return rows[0] ? rb_Integer(rb_str_new2(rows)) : Qnil;
+	return st->cmd_tuples[0] ? rb_cstr2inum(st->cmd_tuples, 10) : Qnil;
 }
 
 /*
@@ -770,13 +2052,20 @@ AltPg_St_column_info(VALUE self)
 	// XXX - module-level strings for keys?
 	VALUE ret;
 	VALUE iv_type_map;
-	int i;
+	PGresult *res;
+	int i, nfields;
 
 	st = altpg_st_get_unfinished(self);
-	ret = rb_ary_new2(st->nfields);
+
+	/* The row description is known once prepared, before any execute() */
+	if (!st->res) altpg_st_describe(self, st);
+	res = st->res ? st->res : st->desc;
+	nfields = res ? PQnfields(res) : 0;
+
+	ret = rb_ary_new2(nfields);
 	iv_type_map = rb_iv_get(self, "@type_map");
 
-	for (i = 0; i < st->nfields; ++i) {
+	for (i = 0; i < nfields; ++i) {
 		VALUE col = rb_hash_new();
 		VALUE type_map_entry;
 		int typmod, typlen;
@@ -785,9 +2074,9 @@ AltPg_St_column_info(VALUE self)
 		Oid type_oid;
 
 		rb_hash_aset(col, rb_str_new2("name"),
-		                  rb_str_new2(PQfname(st->res, i)));
+		                  rb_str_new2(PQfname(res, i)));
 
-		type_oid = PQftype(st->res, i);
+		type_oid = PQftype(res, i);
 		type_map_entry = rb_hash_aref(iv_type_map, INT2FIX(type_oid));
 
 		// col['type_name'] = @type_map[16][:type_name]
@@ -798,13 +2087,13 @@ AltPg_St_column_info(VALUE self)
 		                  rb_hash_aref(type_map_entry, sym_dbi_type));
 		/*
 		printf("\tcolumn \"%s\", Oid %lu, type %s\n",
-					 PQfname(st->res, i),
+					 PQfname(res, i),
 		       type_oid,
 		       RSTRING_PTR(rb_hash_aref(type_map_entry, sym_type_name)));
 		*/
 
-		typmod = PQfmod(st->res, i);
-		typlen = PQfsize(st->res, i);
+		typmod = PQfmod(res, i);
+		typlen = PQfsize(res, i);
 
 		if (typlen > 0) {
 			precision = INT2FIX(typlen);
@@ -836,19 +2125,35 @@ Init_pq()
 	rb_define_private_method(rbx_cDb, "pq_connect_db", AltPg_Db_pq_connect_db, 1);
 	rb_define_private_method(rbx_cDb, "pq_socket", AltPg_Db_pq_socket, 0);
 	rb_define_private_method(rbx_cDb, "pq_notifies", AltPg_Db_pq_notifies, 1);
+	rb_define_private_method(rbx_cDb, "pq_result_memory", AltPg_Db_pq_result_memory, 0);
+	rb_define_private_method(rbx_cDb, "pq_result_memory_reset", AltPg_Db_pq_result_memory_reset, 0);
+	rb_define_private_method(rbx_cDb, "pq_select_timed", AltPg_Db_pq_select_timed, 2);
+	rb_define_private_method(rbx_cDb, "pq_lo_int", AltPg_Db_pq_lo_int, 2);
+	rb_define_private_method(rbx_cDb, "pq_lo_read", AltPg_Db_pq_lo_read, 3);
+	rb_define_private_method(rbx_cDb, "pq_lo_write", AltPg_Db_pq_lo_write, 2);
+	rb_define_private_method(rbx_cDb, "pq_exec_batch", AltPg_Db_pq_exec_batch, 2);
+#ifdef LIBPQ_HAS_PIPELINING
+	rb_define_private_method(rbx_cDb, "pq_exec_pipeline", AltPg_Db_pq_exec_pipeline, 1);
+#endif
 	rb_define_method(rbx_cDb, "in_transaction?", AltPg_Db_in_transaction_p, 0);
 	rb_define_method(rbx_cDb, "database_name", AltPg_Db_dbname, 0);
 	rb_define_method(rbx_cDb, "disconnect", AltPg_Db_disconnect, 0);
 	rb_define_method(rbx_cDb, "commit", AltPg_Db_commit, 0);
-	rb_define_method(rbx_cDb, "rollback", AltPg_Db_rollback, 0);
+	rb_define_private_method(rbx_cDb, "pq_rollback", AltPg_Db_rollback, 0);
+
+	rb_define_const(rbx_mAltPg, "INV_READ", INT2FIX(INV_READ));
+	rb_define_const(rbx_mAltPg, "INV_WRITE", INT2FIX(INV_WRITE));
 
 	rb_define_alloc_func(rbx_cSt, AltPg_St_s_alloc);
 	rb_define_method(rbx_cSt, "initialize", AltPg_St_initialize, 4);
 	rb_define_method(rbx_cSt, "cancel", AltPg_St_cancel, 0);
 	rb_define_method(rbx_cSt, "finish", AltPg_St_finish, 0);
-	rb_define_method(rbx_cSt, "execute", AltPg_St_execute, 0);
+	rb_define_private_method(rbx_cSt, "pq_prepare", AltPg_St_pq_prepare, 2);
+	rb_define_private_method(rbx_cSt, "pq_describe", AltPg_St_pq_describe, 0);
+	rb_define_private_method(rbx_cSt, "pq_execute", AltPg_St_pq_execute, 1);
 	rb_define_method(rbx_cSt, "fetch", AltPg_St_fetch, 0);
 	rb_define_method(rbx_cSt, "rows", AltPg_St_rows, 0);
+	rb_define_private_method(rbx_cSt, "pq_fetch_columns", AltPg_St_pq_fetch_columns, 0);
 	rb_define_method(rbx_cSt, "column_info", AltPg_St_column_info, 0);
 
 	id_translate_parameters = rb_intern("translate_parameters");
@@ -0,0 +1,290 @@
+#!/usr/bin/env ruby
+
+#
+# A Database stand-in which spreads reads over standby servers.
+#
+# DBI::DBD::AltPg::Driver#connect returns a Router instead of a Database
+# when given an 'altpg_replicas' attribute: one conninfo string, or an
+# Array of them.  The DSN's database name, user and password are used for
+# each replica unless its conninfo says otherwise.
+#
+# A statement whose action is SELECT or VALUES, prepared outside of a
+# transaction, goes to a healthy replica.  Everything else goes to the
+# primary:  writes, DDL, SELECT ... FOR UPDATE or INTO, nextval() and the
+# like, every statement inside a transaction (so, everything with
+# AutoCommit off), and every other handle method and func.
+#
+# Replicas are checked at connect and then at most every
+# 'altpg_replica_check_interval' seconds (default 5).  A replica which
+# cannot be reached, or whose replay lags by more than
+# 'altpg_replica_max_lag' seconds (default unlimited), is skipped until it
+# passes a later check.  Reconnection to an unreachable replica is tried
+# after one interval, then after two, four, and so on up to
+# MaxRetryInterval.  Each attempt waits at most connect_timeout seconds
+# (ReplicaConnectTimeout unless the conninfo says otherwise), and a
+# replica which then takes more than ReplicaCheckTimeout seconds to
+# answer its check is treated as unreachable.  Reads go to the primary
+# when no replica is healthy.  'altpg_balance' picks among healthy
+# replicas:  'round_robin' (the default), or 'least_busy', the one
+# holding the least unconsumed result memory.
+#
+# Each connection is its own session, so temporary tables and SET
+# variables on the primary are not seen by reads sent to a replica.  Run
+# such reads inside a transaction.
+#
+# Example:
+#   dbh = DBI.connect('dbi:AltPg:app', user, pass,
+#                     'altpg_replicas'        => [ 'host=standby1',
+#                                                  'host=standby2' ],
+#                     'altpg_balance'         => 'least_busy',
+#                     'altpg_replica_max_lag' => 10)
+#   dbh.select_all('SELECT * FROM items')       # a standby
+#   dbh.do('UPDATE items SET price = price * 2') # the primary
+#   dbh['altpg_replica_status']
+#   # => [ { 'replica' => 'host=standby1', 'healthy' => true, 'lag' => 0.0,
+#   #        'checked_at' => ..., 'error' => nil }, ... ]
+class DBI::DBD::AltPg::Router < DBI::BaseDatabase
+  Balancers = %w(round_robin least_busy) # :nodoc:
+
+  # Default connect_timeout for replicas, as checks run inline in #prepare
+  ReplicaConnectTimeout = 2
+
+  # Seconds a connected replica has to answer a check
+  ReplicaCheckTimeout = 2
+
+  # Longest wait, in seconds, between attempts to reach a down replica
+  MaxRetryInterval = 300
+
+  # SELECTs which must run on the primary despite their action. (:nodoc:)
+  Regex_NotReadOnly = %r{
+       \bFOR\s+(?:NO\s+KEY\s+)?UPDATE\b   # row locks
+    |  \bFOR\s+(?:KEY\s+)?SHARE\b
+    |  \bINTO\b                           # SELECT ... INTO new_table
+    |  \b(?:nextval|setval|lastval|pg_(?:try_)?advisory_\w+|txid_current
+          |pg_current_xact_id|pg_notify)\s*\(
+  }ix    # :nodoc:
+
+  Replica = Struct.new(:name, :conninfo, :db, :version,
+                       :healthy, :lag, :checked_at, :error,
+                       :failures, :retry_at) # :nodoc:
+
+  # read_only?(sql, action) -> true or false
+  #
+  # Whether a statement, with its action as from
+  # DBI::DBD::AltPg.translate_sql, may be sent to a replica.
+  def self.read_only?(sql, action)
+    case action
+    when "select", "values"
+      sql !~ Regex_NotReadOnly
+    else
+      false
+    end
+  end
+
+  def initialize(conninfo, replicas, dbd_driver, attr = {})
+    @parent = dbd_driver
+    @attr = {
+      'altpg_balance'                => 'round_robin',
+      'altpg_replica_check_interval' => 5,
+      'altpg_replica_max_lag'        => nil,
+    }
+
+    @primary = DBI::DBD::AltPg::Database.new(conninfo, dbd_driver)
+    @replicas = [ *replicas ].collect do |r|
+      Replica.new(r.gsub(/password\s*=\s*('(?:[^'\\]|\\.)*'|\S+)/, 'password=...'),
+                  "#{conninfo} connect_timeout=#{ReplicaConnectTimeout} #{r}")
+    end
+    @next_replica = 0
+
+    @attr.keys.each { |key| self[key] = attr[key] if attr.has_key?(key) }
+    check_replicas
+  end
+
+  def [](key)
+    case key
+    when 'altpg_balance', 'altpg_replica_check_interval', 'altpg_replica_max_lag'
+      @attr[key]
+    when 'altpg_replica_status'
+      @replicas.collect do |r|
+        { 'replica' => r.name, 'healthy' => r.healthy, 'lag' => r.lag,
+          'checked_at' => r.checked_at, 'error' => r.error }
+      end
+    else
+      @primary[key]
+    end
+  end
+
+  def []=(key, value)
+    case key
+    when 'altpg_balance'
+      unless Balancers.include?(value)
+        raise DBI::ProgrammingError, "dbh['#{key}'] must be one of #{Balancers.join(', ')}"
+      end
+    when 'altpg_replica_check_interval'
+      unless value.is_a?(Numeric)
+        raise DBI::ProgrammingError, "dbh['#{key}'] must be a number of seconds"
+      end
+    when 'altpg_replica_max_lag'
+      unless value.nil? or value.is_a?(Numeric)
+        raise DBI::ProgrammingError, "dbh['#{key}'] must be a number of seconds or nil"
+      end
+      @checked_at = nil  # recheck against the new limit
+    when 'altpg_replica_status'
+      raise DBI::ProgrammingError, "Attempt to modify read-only dbh['#{key}']"
+    else
+      return @primary[key] = value
+    end
+    @attr[key] = value
+  end
+
+  def prepare(query)
+    sql, param_count, action = DBI::DBD::AltPg.translate_sql(query)
+    db = @primary
+    if self.class.read_only?(sql, action) and not @primary.in_transaction?
+      replica = pick_replica
+      db = replica.db if replica
+    end
+    db.prepare(query)
+  end
+
+  def disconnect
+    @replicas.each { |r| r.db.disconnect rescue nil if r.db }
+    @primary.disconnect
+  end
+
+  def ping
+    @primary.ping
+  end
+
+  def commit
+    @primary.commit
+  end
+
+  def rollback
+    @primary.rollback
+  end
+
+  def in_transaction?
+    @primary.in_transaction?
+  end
+
+  def database_name
+    @primary.database_name
+  end
+
+  def tables
+    @primary.tables
+  end
+
+  def columns(table)
+    @primary.columns(table)
+  end
+
+  #
+  # dbh.func(:check_replicas) => number of healthy replicas
+  #
+  # Check every replica now, rather than waiting out
+  # dbh['altpg_replica_check_interval'] or any backoff.
+  def __check_replicas
+    @replicas.each { |r| r.retry_at = nil }
+    check_replicas
+    @replicas.count { |r| r.healthy }
+  end
+
+  # Other funcs are the primary's
+  def method_missing(name, *args, &block)
+    return super unless primary_func?(name)
+    @primary.__send__(name, *args, &block)
+  end
+
+  def respond_to_missing?(name, include_private = false)
+    primary_func?(name) || super
+  end
+
+  private
+
+  def primary_func?(name)
+    !!(name.to_s =~ /\A__/ and @primary.respond_to?(name))
+  end
+
+  # A healthy replica, rechecking first if due, or nil.
+  def pick_replica
+    interval = @attr['altpg_replica_check_interval']
+    check_replicas if @checked_at.nil? or Time.now - @checked_at >= interval
+
+    healthy = @replicas.select { |r| r.healthy }
+    return nil if healthy.empty?
+
+    @next_replica = (@next_replica + 1) % healthy.length
+    if @attr['altpg_balance'] == 'least_busy'
+      # Ties go round-robin
+      healthy.rotate(@next_replica).min_by { |r| r.db['altpg_result_memory'] }
+    else
+      healthy[@next_replica]
+    end
+  end
+
+  def check_replicas
+    @replicas.each { |r| check_replica(r) }
+    @checked_at = Time.now
+  end
+
+  def check_replica(replica)
+    return if replica.retry_at and Time.now < replica.retry_at
+
+    replica.checked_at = Time.now
+    unless replica.db
+      replica.db = DBI::DBD::AltPg::Database.new(replica.conninfo, @parent)
+      replica.version = probe(replica.db,
+        "SELECT pg_catalog.current_setting('server_version_num')")[0].to_i
+    end
+
+    replica.lag = probe(replica.db, lag_sql(replica.version))[0].to_f
+    max_lag = @attr['altpg_replica_max_lag']
+    if max_lag and replica.lag > max_lag
+      replica.healthy = false
+      replica.error = "replica lag of #{replica.lag}s exceeds #{max_lag}s"
+    else
+      replica.healthy = true
+      replica.error = nil
+    end
+    replica.failures = 0
+    replica.retry_at = nil
+  rescue ::DBI::DatabaseError => e
+    # Reconnect later, backing off.  The old connection lives on, unused,
+    # until any statements prepared on it are gone.
+    replica.db = nil
+    replica.healthy = false
+    replica.lag = nil
+    replica.error = e.message
+    replica.failures = (replica.failures || 0) + 1
+    backoff = [ @attr['altpg_replica_check_interval'], 1 ].max * 2 ** (replica.failures - 1)
+    replica.retry_at = replica.checked_at + [ backoff, MaxRetryInterval ].min
+  end
+
+  # Seconds the replica's replay is behind, or zero if it is caught up
+  # with what it has received (or is not in recovery at all).
+  def lag_sql(version)
+    wal, lsn = version >= 100000 ? %w(wal lsn) : %w(xlog location)
+    <<-eosql
+SELECT
+  CASE
+    WHEN NOT pg_catalog.pg_is_in_recovery() THEN 0
+    WHEN pg_catalog.pg_last_#{wal}_receive_#{lsn}()
+           = pg_catalog.pg_last_#{wal}_replay_#{lsn}() THEN 0
+    ELSE COALESCE(EXTRACT(EPOCH FROM now()
+                          - pg_catalog.pg_last_xact_replay_timestamp()), 0)
+  END::float8
+    eosql
+  end
+
+  # The first row of a check query, as text.  The server gives up on the
+  # query after ReplicaCheckTimeout seconds, and we stop waiting a second
+  # later, should the server itself be stuck.  Either way raises a
+  # DBI::DatabaseError.
+  def probe(db, sql)
+    db.__send__(:pq_select_timed,
+                "SET LOCAL statement_timeout = #{ReplicaCheckTimeout * 1000};\n#{sql}",
+                ReplicaCheckTimeout + 1)
+  end
+end #-- class DBI::DBD::AltPg::Router
@@ -2,10 +2,48 @@
 
 class DBI::DBD::AltPg::Statement < DBI::BaseStatement
 
+  # A column of fixed-width values as returned by __fetch_columns.
+  #
+  # +data+ holds one native-endian value per row, suitable for
+  # data.unpack("#{directive}*") or handing to NArray and friends, and
+  # +nulls+ is a bitmap in which bit (i % 8) of byte (i / 8) is set iff row
+  # i is NULL.  NULL rows are zero in +data+.  Dates are packed as days,
+  # and timestamps as microseconds, since 2000-01-01.
+  PackedColumn = Struct.new(:type_name, :directive, :data, :nulls)
+  class PackedColumn
+    def length
+      data.length / [0].pack(directive).length
+    end
+
+    def null?(i)
+      nulls[i / 8, 1].unpack('C')[0][i % 8] == 1
+    end
+
+    def to_a
+      values = data.unpack("#{directive}*")
+      values.each_index { |i| values[i] = nil if null?(i) }
+      values
+    end
+  end
+
+  PackedDirectives = {
+    'bool'        => 'C',
+    'int2'        => 's',
+    'int4'        => 'l',
+    'int8'        => 'q',
+    'float4'      => 'f',
+    'float8'      => 'd',
+    'date'        => 'l',
+    'timestamp'   => 'q',
+    'timestamptz' => 'q',
+  } # :nodoc:
+
   def [](key)
     case key
     when "altpg_statement_name", "altpg_plan"
       @plan.freeze
+    when "altpg_param_types"
+      @param_types && @param_types.collect { |oid| @type_map[oid][:type_name] }
     when /^altpg_/
       raise DBI::NotSupportedError, "Attribute sth['#{key}'] is not supported"
     else
@@ -22,32 +60,186 @@ class DBI::DBD::AltPg::Statement < DBI::BaseStatement
     (@attr ||= {})[key] = value
   end
 
+  Int2Range = -2**15 ... 2**15 # :nodoc:
+  Int4Range = -2**31 ... 2**31 # :nodoc:
+  Int8Range = -2**63 ... 2**63 # :nodoc:
+
+  # translate_param(value) -> [ string, typname, format ]
+  #
+  # Map a ruby value to its wire representation, a guess at its pg type
+  # name (a Symbol) and the pg format code, 0 (text) or 1 (binary).
+  #
+  # Strings are left for the server to infer (:unknown), and Integers are
+  # offered as int8, which (unlike numeric) compares with any integral
+  # column without casting the column.
+  def self.translate_param(value)
+    case value
+    when nil
+      [nil, :unknown, 0]
+    when TrueClass
+      #["\1", :bool, 1 ]
+      ["t", :bool, 0 ]
+    when FalseClass
+      #["\0", :bool, 1 ]
+      ["f", :bool, 0 ]
+    when String
+      [ value, :unknown, 0 ]
+    #when DBI::DBD::AltPg::Type::ByteA
+    #  [ value, :bytea, 1 ]
+    when ::Time, ::DateTime
+      [ value.strftime('%Y-%m-%d %H:%M:%S.%6N%:z'), :timestamptz, 0 ]
+    when ::Date
+      [ value.strftime('%Y-%m-%d'), :date, 0 ]
+    when BigDecimal
+      [ value.to_s('F'), :numeric, 0 ]
+    when Integer
+      [ value.to_s, Int8Range.include?(value) ? :int8 : :numeric, 0 ]
+    when Numeric
+      [ value.to_s, :numeric, 0 ]
+    else
+      [ value.to_s, :unknown, 0 ]
+    end
+  end
+
   def bind_param(i, value, extra)
-    translated = case value
-                 when nil
-                   [nil, :unknown, 0]
-                 when TrueClass
-                   #["\1", :bool, 1 ]
-                   ["t", :bool, 0 ]
-                 when FalseClass
-                   #["\0", :bool, 1 ]
-                   ["f", :bool, 0 ]
-                 when String
-                   [ value, :varchar, 1 ]
-                 #when DBI::DBD::AltPg::Type::ByteA
-                 #  [ value, :bytea, 1 ]
-                 when ::Date
-                   [ value.strftime('%Y-%m-%d'), :date, 0 ]
-                 when ::Time, ::DateTime
-                   [ value.strftime("%Y-%m-%dT%H:%M:%S%Z"), :timestamptz, 0 ]
-                 when BigDecimal
-                   [ value.to_s('F'), :numeric, 0 ]
-                 when Numeric
-                   [ value.to_s, :numeric, 0 ]
-                 else
-                   [ value.to_s, :unknown, 0 ]
-                 end
-    translated[1] = @type_map[ translated[1] ][:oid]
-    @params[i - 1] = translated
+    @params[i - 1] = value
+  end
+
+  def execute
+    if @params.length != @param_count
+      # Let's be charitable and give the user an opportunity to recover.
+      # Presently in the DBI, there's no way to clear bound parameters.
+      supplied = @params.length
+      @params.clear
+      raise DBI::ProgrammingError, "#{supplied} parameters supplied, but prepared statement \"#{@plan}\" requires #{@param_count}"
+    end
+
+    prepare_and_describe if @param_types.nil? or zone_dropped?
+
+    encoded = []
+    @params.each_index do |i|
+      encoded[i] = encode_param(@params[i], @param_types[i])
+    end
+    pq_execute(encoded)
+  end
+
+  #
+  # sth.func(:describe) => column_info
+  #
+  # Prepare the statement, if not yet done, and return its column_info()
+  # as described by the server, which DBI otherwise offers only after
+  # execution.  The parameter types the server infers are fixed for the
+  # life of the statement:  later values are encoded to suit them.  The
+  # exception is a Time or DateTime bound where the server inferred
+  # timestamp, which re-prepares the statement to take timestamptz.
+  def __describe
+    prepare_and_describe unless @param_types
+    column_info
+  end
+
+  #
+  # sth.func(:fetch_columns) => [ column, ... ] or nil
+  #
+  # Fetch all remaining rows of an executed statement column by column,
+  # without building per-row objects.  Fixed-width binary columns (bool,
+  # int2/4/8, float4/8, date, timestamp) are returned as PackedColumn
+  # objects; every other column is returned as an Array of converted
+  # values.
+  #
+  # Example:
+  #   sth = dbh.execute('SELECT id, price, label FROM items')
+  #   ids, prices, labels = sth.func(:fetch_columns)
+  #   prices.data.unpack('d*')   # => [ 9.99, 0.0, ... ]
+  #   labels                     # => [ 'widget', nil, ... ]
+  def __fetch_columns
+    info = column_info                 # while the result is still held
+    columns = pq_fetch_columns or return nil
+
+    columns.each_index do |i|
+      data, nulls = columns[i]
+      type_name = info[i]['type_name']
+      if nulls
+        columns[i] = PackedColumn.new(type_name, PackedDirectives[type_name],
+                                      data, nulls)
+      else
+        dbi_type = info[i]['dbi_type']
+        columns[i] = data.collect! { |v| dbi_type.parse(v) }
+      end
+    end
+    columns
+  end
+
+  private
+
+  # PREPARE and DESCRIBE the statement, remembering the parameter types
+  # the server settled on.  Those types then govern #encode_param.
+  #
+  # The server infers every parameter's type where it can, save that Time
+  # and DateTime values are always timestamptz, so that the server, not
+  # we, converts them to the session TimeZone.  Only where it cannot
+  # (e.g., "INSERT ... SELECT ?") do we offer types guessed from the
+  # values bound, Strings and nils as text.  A statement without
+  # parameters has nothing to learn, and is described only if need be.
+  def prepare_and_describe
+    hints = @params.each_index.collect do |i|
+      if zoned?(@params[i])
+        @type_map[:timestamptz][:oid]
+      elsif @param_types
+        @param_types[i]         # re-preparing:  keep what was inferred
+      end
+    end
+    @param_types = pq_prepare(hints, @param_count > 0) || []
+  rescue DBI::DatabaseError => e
+    raise unless e.state == '42P18'      # indeterminate_datatype
+    hints = @params.collect do |value|
+      typname = self.class.translate_param(value)[1]
+      @type_map[typname == :unknown ? :text : typname][:oid]
+    end
+    @param_types = pq_prepare(hints, true)
+  end
+
+  def zoned?(value)
+    value.is_a?(::Time) or value.is_a?(::DateTime)
+  end
+
+  # Whether a Time or DateTime is bound where the statement takes a
+  # timestamp, which would drop its zone.
+  def zone_dropped?
+    @params.each_index.any? do |i|
+      zoned?(@params[i]) and @type_map[@param_types[i]][:type_name] == 'timestamp'
+    end
+  end
+
+  # encode_param(value, oid) -> [ string, oid, format ]
+  #
+  # Encode +value+ for a parameter the server has described as type +oid+,
+  # in binary where we readily can, and in text otherwise.
+  def encode_param(value, oid)
+    return [ nil, oid, 0 ] if value.nil?
+
+    binary = case @type_map[oid][:type_name]
+             when 'int2'
+               [value].pack('n') if value.is_a?(Integer) and Int2Range.include?(value)
+             when 'int4'
+               [value].pack('N') if value.is_a?(Integer) and Int4Range.include?(value)
+             when 'int8'
+               if value.is_a?(Integer) and Int8Range.include?(value)
+                 [value >> 32, value & 0xffff_ffff].pack('NN')
+               end
+             when 'float4'
+               [value].pack('g') if value.is_a?(Integer) or value.is_a?(Float)
+             when 'float8'
+               [value].pack('G') if value.is_a?(Integer) or value.is_a?(Float)
+             when 'bool'
+               case value
+               when TrueClass  then "\001"
+               when FalseClass then "\000"
+               end
+             when 'text', 'varchar', 'bpchar', 'name', 'bytea'
+               value if value.is_a?(String)
+             end
+
+    return [ binary, oid, 1 ] if binary
+    [ self.class.translate_param(value)[0], oid, 0 ]
   end
 end #-- class DBI::DBD::AltPg::Statement
@@ -0,0 +1,85 @@
+#!/usr/bin/env ruby
+
+require File.dirname(__FILE__) + "/test_helper"
+
+class TestAltPgBatch < Test::Unit::TestCase
+  def setup
+    @dbh = DBI.connect(*TestHelper::ConnArgs)
+  end
+
+  def teardown
+    @dbh.disconnect rescue nil
+  end
+
+  def test_batch_simple
+    r = @dbh.func(:do_batch, [ 'CREATE TEMP TABLE t (i INT)',
+                               'INSERT INTO t SELECT 1 UNION SELECT 2;',
+                               "-- comment\nUPDATE t SET i = i + 10",
+                               'SELECT * FROM t' ])
+    assert_equal([ nil, 2, 2, 2 ], r)
+    assert_equal([ [11], [12] ], @dbh.select_all('SELECT i FROM t ORDER BY i'))
+  end
+
+  def test_batch_trailing_comment
+    assert_equal([ 1, 1 ], @dbh.func(:do_batch, [ 'SELECT 1 -- one', 'SELECT 2' ]))
+
+    assert_equal([ 1 ], @dbh.func(:do_batch, [ "SELECT 1; -- done\n;" ]))
+  end
+
+  def test_batch_multiple_statements
+    @dbh.do('CREATE TEMP TABLE t (i INT)')
+
+    # One element, two statements:  rejected before anything runs
+    [ [ 'INSERT INTO t VALUES (1)', 'INSERT INTO t VALUES (2); DELETE FROM t' ],
+      [ [ 'INSERT INTO t VALUES (?)', 1 ], 'INSERT INTO t VALUES (2);SELECT 1' ]
+    ].each do |batch|
+      assert_raises(DBI::ProgrammingError) { @dbh.func(:do_batch, batch) }
+      assert_equal([], @dbh.select_all('SELECT * FROM t'))
+    end
+
+    # A ; inside literals and comments is not a terminator
+    assert_equal([ 1 ], @dbh.func(:do_batch, [ "INSERT INTO t SELECT length(';x' || $$;$$) /* ; */" ]))
+    assert_equal([ [3] ], @dbh.select_all('SELECT * FROM t'))
+  end
+
+  def test_batch_parameterized
+    @dbh.do('CREATE TEMP TABLE t (i INT, v VARCHAR(64))')
+    r = @dbh.func(:do_batch, [ [ 'INSERT INTO t VALUES (?, ?)', 1, 'foo' ],
+                               [ 'INSERT INTO t VALUES (?, ?)', 2, nil ],
+                               'DELETE FROM t WHERE i = 1' ])
+    assert_equal([ 1, 1, 1 ], r)
+    assert_equal([ [2, nil] ], @dbh.select_all('SELECT * FROM t'))
+  end
+
+  def test_batch_failure
+    @dbh.do('CREATE TEMP TABLE t (i INT)')
+    e = assert_raises(DBI::DatabaseError) do
+      @dbh.func(:do_batch, [ 'INSERT INTO t VALUES (1)',
+                             'INSERT INTO t VALUES (1/0)',
+                             'INSERT INTO t VALUES (3)' ])
+    end
+    assert_equal(1, e.err)
+    assert_equal('22012', e.state)
+    assert_match(/statement 1/, e.message)
+
+    # The batch is atomic outside of a transaction
+    assert_equal([ [0] ], @dbh.select_all('SELECT COUNT(*) FROM t'))
+
+    e = assert_raises(DBI::DatabaseError) do
+      @dbh.func(:do_batch, [ [ 'INSERT INTO t VALUES (?)', 1 ],
+                             [ 'INSERT INTO t VALUES (?)', 2 ],
+                             [ 'INSERT INTO t VALUES (?::INT / 0)', 3 ] ])
+    end
+    assert_equal(2, e.err)
+  end
+
+  def test_batch_misuse
+    assert_equal([], @dbh.func(:do_batch, []))
+    assert_raises(DBI::ProgrammingError) do
+      @dbh.func(:do_batch, [ 'SELECT 1', '-- nothing' ])
+    end
+    assert_raises(DBI::ProgrammingError) do
+      @dbh.func(:do_batch, [ [ 'SELECT ?, ?', 1 ] ])
+    end
+  end
+end
@@ -0,0 +1,87 @@
+#!/usr/bin/env ruby
+
+require File.dirname(__FILE__) + "/test_helper"
+
+class TestAltPgCatalog < Test::Unit::TestCase
+  def setup
+    @dbh = DBI.connect(*TestHelper::ConnArgs)
+    @dbh.do('CREATE TEMP TABLE cat_a (id INT PRIMARY KEY, name VARCHAR(32) NOT NULL)')
+    @dbh.do('CREATE TEMP TABLE cat_b (price NUMERIC(10, 2) DEFAULT 0)')
+  end
+
+  def teardown
+    @dbh.disconnect rescue nil
+  end
+
+  def assert_catalog_agrees
+    tables = @dbh.tables
+    columns = %w(cat_a cat_b).collect { |t| @dbh.columns(t) }
+
+    @dbh['altpg_catalog_ttl'] = 60
+    assert_equal(tables.length, @dbh.func(:catalog_preload))
+    assert_equal(tables.sort, @dbh.tables.sort)
+    assert_equal(columns, %w(cat_a cat_b).collect { |t| @dbh.columns(t) })
+  ensure
+    @dbh['altpg_catalog_ttl'] = nil
+  end
+
+  def test_columns
+    cols = @dbh.columns('cat_a')
+    assert_equal(%w(id name), cols.collect { |c| c['name'] })
+    assert(cols[0]['primary'])
+    assert(! cols[1]['nullable'])
+
+    assert_equal([], @dbh.columns('no_such_table'))
+    assert_catalog_agrees
+  end
+
+  def test_cache_invalidation
+    @dbh['altpg_catalog_ttl'] = 3600
+    assert_equal(2, @dbh.columns('cat_a').length)
+
+    @dbh.do('ALTER TABLE cat_a ADD COLUMN extra INT')  # implicit flush
+    assert_equal(3, @dbh.columns('cat_a').length)
+
+    DBI.connect(*TestHelper::ConnArgs) do |dbh2|
+      dbh2.do('CREATE TABLE cat_shared (i INT)')
+    end
+    assert(! @dbh.tables.include?('cat_shared'))       # stale ...
+    @dbh.func(:catalog_flush)
+    assert(@dbh.tables.include?('cat_shared'))         # ... until flushed
+    @dbh.func(:do_batch, [ 'DROP TABLE cat_shared' ])
+    assert(! @dbh.tables.include?('cat_shared'))
+
+    assert(! @dbh.tables.include?('cat_c'))
+    @dbh.do('CREATE TEMP TABLE cat_c ()')
+    assert(@dbh.tables.include?('cat_c'))
+    assert_equal([], @dbh.columns('cat_c'))
+
+    # search_path decides which tables are visible
+    @dbh.do('CREATE TABLE cat_pub (i INT)')
+    assert(@dbh.tables.include?('cat_pub'))
+    @dbh.func(:set_variable, 'search_path', 'pg_catalog')
+    assert(! @dbh.tables.include?('cat_pub'))
+  ensure
+    @dbh.do('DROP TABLE IF EXISTS public.cat_pub') rescue nil
+  end
+
+  def test_cache_rollback
+    @dbh['altpg_catalog_ttl'] = 3600
+
+    # Cached inside a transaction, then rolled back
+    @dbh['AutoCommit'] = false
+    @dbh.do('CREATE TEMP TABLE cat_r1 (i INT)')
+    assert(@dbh.tables.include?('cat_r1'))
+    @dbh.rollback
+    assert(! @dbh.tables.include?('cat_r1'))
+
+    @dbh['AutoCommit'] = true
+    %w(ROLLBACK ABORT).each do |verb|
+      @dbh.do('BEGIN')
+      @dbh.do('CREATE TEMP TABLE cat_r2 (i INT)')
+      assert(@dbh.tables.include?('cat_r2'))
+      @dbh.do(verb)
+      assert(! @dbh.tables.include?('cat_r2'))
+    end
+  end
+end
@@ -0,0 +1,82 @@
+#!/usr/bin/env ruby
+
+require File.dirname(__FILE__) + "/test_helper"
+
+class TestAltPgDescribe < Test::Unit::TestCase
+  def setup
+    @dbh = DBI.connect(*TestHelper::ConnArgs)
+    @dbh.do('CREATE TEMP TABLE d (id BIGINT PRIMARY KEY, small INT2, v TEXT)')
+    @dbh.do(%q|INSERT INTO d VALUES (1, 1, 'one'), (2, 2, 'two')|)
+  end
+
+  def teardown
+    @dbh.disconnect rescue nil
+  end
+
+  def test_describe_before_execute
+    @dbh.prepare('SELECT id, v FROM d WHERE id = ?') do |sth|
+      info = sth.func(:describe)
+      assert_equal(%w(id v), info.collect { |c| c['name'] })
+      assert_equal(%w(int8 text), info.collect { |c| c['type_name'] })
+      assert_equal(['int8'], sth['altpg_param_types'])
+
+      sth.execute(2)
+      assert_equal([ [2, 'two'] ], sth.fetch_all)
+    end
+  end
+
+  def test_server_inferred_types
+    @dbh.prepare('SELECT v FROM d WHERE small = ? AND v = ?') do |sth|
+      sth.execute(1, 'one')
+      assert_equal(%w(int2 text), sth['altpg_param_types'])
+      assert_equal([ ['one'] ], sth.fetch_all)
+
+      # Later values are encoded for the described types
+      sth.execute('2', 'two')
+      assert_equal([ ['two'] ], sth.fetch_all)
+
+      assert_raises(DBI::DatabaseError) do
+        sth.execute(2**20, 'two')                   # out of int2 range
+      end
+    end
+  end
+
+  def test_untyped_params
+    assert_equal([ 'foo', true, 5 ],
+                 @dbh.select_one('SELECT ?, ?, ?', 'foo', true, 5).to_a)
+    assert_equal("foo\000bar",
+                 @dbh.select_one('SELECT ?::bytea', "foo\000bar")[0])
+  end
+
+  def test_untyped_params_in_transaction
+    @dbh['AutoCommit'] = false
+    @dbh.do('INSERT INTO d (id, v) SELECT ?, ?', 3, 'three')
+    assert_equal('three', @dbh.select_one('SELECT v FROM d WHERE id = ?', 3)[0])
+    @dbh.commit
+  ensure
+    @dbh['AutoCommit'] = true
+  end
+
+  def test_time_params_keep_zone
+    @dbh.do("SET TimeZone TO 'UTC'")
+    @dbh.do('CREATE TEMP TABLE tz (id INT, ts TIMESTAMP, tstz TIMESTAMPTZ, d DATE)')
+    t = Time.new(2010, 6, 1, 23, 30, 0, '-05:00')
+    @dbh.do('INSERT INTO tz VALUES (1, ?, ?, ?)', t, t, t)
+    row = @dbh.select_one('SELECT ts::text, tstz::text, d::text FROM tz')
+    assert_equal([ '2010-06-02 04:30:00', '2010-06-02 04:30:00+00', '2010-06-02' ], row.to_a)
+
+    # Prepared as timestamp for a String, then bound a Time
+    @dbh.prepare('UPDATE tz SET ts = ? WHERE id = 1') do |sth|
+      sth.execute('2001-01-01 00:00:00')
+      assert_equal('timestamp', sth['altpg_param_types'][0])
+      sth.execute(DateTime.new(2001, 1, 1, 12, 0, 0, '+02:00'))
+      assert_equal('timestamptz', sth['altpg_param_types'][0])
+    end
+    assert_equal('2001-01-01 10:00:00', @dbh.select_one('SELECT ts::text FROM tz')[0])
+  end
+
+  def test_batch_params_inferred
+    assert_equal([ 1 ], @dbh.func(:do_batch, [ [ 'UPDATE d SET small = ? WHERE id = ?', '5', 1 ] ]))
+    assert_equal(5, @dbh.select_one('SELECT small FROM d WHERE id = 1')[0])
+  end
+end
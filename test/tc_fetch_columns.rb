@@ -0,0 +1,53 @@
+#!/usr/bin/env ruby
+
+require File.dirname(__FILE__) + "/test_helper"
+
+class TestAltPgFetchColumns < Test::Unit::TestCase
+  def setup
+    @dbh = DBI.connect(*TestHelper::ConnArgs)
+    @dbh.do(<<'eosql')
+CREATE TEMP VIEW cols AS
+  SELECT 1::int2 AS s, 1::int8 AS q, 0.5::float8 AS d, true AS b, 'one'::text AS t
+UNION ALL
+  SELECT NULL::int2, -2::int8, NULL::float8, false, NULL::text
+UNION ALL
+  SELECT -3::int2, (2^40)::int8, -1.25::float8, NULL::bool, 'three'::text
+eosql
+  end
+
+  def teardown
+    @dbh.disconnect rescue nil
+  end
+
+  def test_fetch_columns
+    sth = @dbh.execute('SELECT * FROM cols')
+    s, q, d, b, t = sth.func(:fetch_columns)
+
+    assert_equal('int2', s.type_name)
+    assert_equal(3, s.length)
+    assert_equal([1, 0, -3], s.data.unpack('s*'))
+    assert_equal([1, nil, -3], s.to_a)
+
+    assert_equal('int8', q.type_name)
+    assert_equal([1, -2, 2**40], q.to_a)
+    assert_equal([0.5, nil, -1.25], d.to_a)
+    assert(d.null?(1))
+    assert(! d.null?(2))
+    assert_equal([1, 0, nil], b.to_a)
+
+    assert_equal(['one', nil, 'three'], t)
+
+    assert_nil(sth.fetch)
+    sth.finish
+  end
+
+  def test_fetch_columns_remaining
+    sth = @dbh.execute('SELECT s, t FROM cols')
+    assert_equal([1, 'one'], sth.fetch)
+
+    s, t = sth.func(:fetch_columns)
+    assert_equal([nil, -3], s.to_a)
+    assert_equal([nil, 'three'], t)
+    sth.finish
+  end
+end
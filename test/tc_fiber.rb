@@ -0,0 +1,50 @@
+#!/usr/bin/env ruby
+
+require File.dirname(__FILE__) + "/test_helper"
+
+begin
+  require 'async'
+rescue LoadError
+  # Fiber scheduler tests need ruby >= 3.0 and the 'async' gem
+end
+
+class TestAltPgFiberScheduler < Test::Unit::TestCase
+  def setup
+    @dbhs = (1..3).collect { DBI.connect(*TestHelper::ConnArgs) }
+  end
+
+  def teardown
+    @dbhs.each { |dbh| dbh.disconnect rescue nil }
+  end
+
+  def test_concurrent_fibers
+    omit_unless(defined?(::Async), "needs the async gem")
+
+    started = Time.now
+    results = []
+    Async do |task|
+      @dbhs.each_with_index.collect { |dbh, i|
+        task.async { results << dbh.select_one("SELECT #{i}, pg_sleep(2)")[0] }
+      }.each { |t| t.wait }
+    end
+
+    assert_equal([0, 1, 2], results.sort)
+    assert(Time.now - started < 4, "queries blocked the fiber scheduler")
+  end
+
+  def test_notifies_in_fiber
+    omit_unless(defined?(::Async), "needs the async gem")
+
+    dbh, notifier = @dbhs
+    dbh.do('LISTEN ping')
+    r = nil
+    Async do |task|
+      waiter = task.async { r = dbh.func(:pq_notifies, 10) }
+      task.async { sleep 1; notifier.do('NOTIFY ping') }
+      waiter.wait
+    end
+
+    assert_kind_of(::Array, r)
+    assert_equal('ping', r[0])
+  end
+end
@@ -0,0 +1,66 @@
+#!/usr/bin/env ruby
+
+require File.dirname(__FILE__) + "/test_helper"
+require 'stringio'
+
+class TestAltPgLargeObject < Test::Unit::TestCase
+  def setup
+    @dbh = DBI.connect(*TestHelper::ConnArgs)
+    @data = (0..255).collect { |i| i.chr }.join * 1024  # 256 KiB, all octets
+  end
+
+  def teardown
+    @dbh.disconnect rescue nil
+  end
+
+  def test_lo_import_export_io
+    oid = @dbh.func(:lo_import, StringIO.new(@data), 10_000)
+    assert_kind_of(Integer, oid)
+
+    out = StringIO.new(''.force_encoding('BINARY'))
+    assert_equal(@data.length, @dbh.func(:lo_export, oid, out, 7_777))
+    assert_equal(@data, out.string)
+  ensure
+    @dbh.func(:lo_unlink, oid) if oid
+  end
+
+  def test_lo_read_binary
+    oid = @dbh.func(:lo_import, StringIO.new(@data))
+    @dbh['AutoCommit'] = false
+    fd = @dbh.func(:lo_open, oid)
+    buf = @dbh.func(:lo_read, fd, 512)
+    assert_equal(Encoding::ASCII_8BIT, buf.encoding)
+    assert_equal(@data[0, 512], buf)
+    @dbh.func(:lo_close, fd)
+  ensure
+    @dbh.rollback rescue nil
+    @dbh['AutoCommit'] = true
+    @dbh.func(:lo_unlink, oid) if oid
+  end
+
+  def test_lo_read_write_seek
+    @dbh['AutoCommit'] = false
+    oid = @dbh.func(:lo_creat)
+    fd = @dbh.func(:lo_open, oid, DBI::DBD::AltPg::INV_READ | DBI::DBD::AltPg::INV_WRITE)
+
+    assert_equal(3, @dbh.func(:lo_write, fd, "foo"))
+    assert_equal(4, @dbh.func(:lo_write, fd, "\000bar"))
+    assert_equal(7, @dbh.func(:lo_tell, fd))
+
+    assert_equal(3, @dbh.func(:lo_seek, fd, 3))
+    buf = ''
+    assert_same(buf, @dbh.func(:lo_read, fd, 2, buf))
+    assert_equal("\000b", buf)
+    assert_equal("ar", @dbh.func(:lo_read, fd, 1024))
+    assert_nil(@dbh.func(:lo_read, fd, 1024))
+
+    assert_equal(0, @dbh.func(:lo_close, fd))
+    @dbh.rollback
+  end
+
+  def test_lo_open_autocommit
+    assert_raises(DBI::ProgrammingError) do
+      @dbh.func(:lo_open, 0)
+    end
+  end
+end
@@ -0,0 +1,68 @@
+#!/usr/bin/env ruby
+
+require File.dirname(__FILE__) + "/test_helper"
+
+class TestAltPgMemory < Test::Unit::TestCase
+  def setup
+    @dbh = DBI.connect(*TestHelper::ConnArgs)
+  end
+
+  def teardown
+    @dbh.disconnect rescue nil
+  end
+
+  def test_consumed_results_released
+    @dbh['altpg_result_memory_peak'] = 0
+    held = @dbh['altpg_result_memory']
+
+    sth = @dbh.execute(%q|SELECT repeat('x', 1000) FROM generate_series(1, 1000)|)
+    assert_operator(@dbh['altpg_result_memory'], :>, held + 1_000_000)
+
+    sth.fetch_all
+    assert_operator(@dbh['altpg_result_memory'], :<, held + 10_000)
+    assert_operator(@dbh['altpg_result_memory_peak'], :>, held + 1_000_000)
+
+    assert_equal(1, sth.column_info.length)
+    assert_equal(1000, sth.rows)
+    assert_nil(sth.fetch)
+    sth.finish
+
+    @dbh['altpg_result_memory_peak'] = 0
+    assert_equal(@dbh['altpg_result_memory'], @dbh['altpg_result_memory_peak'])
+  end
+
+  def test_fetch_columns_releases
+    held = @dbh['altpg_result_memory']
+    sth = @dbh.execute('SELECT i FROM generate_series(1, 10000) i')
+    assert_operator(@dbh['altpg_result_memory'], :>, held)
+    assert_equal(10000, sth.func(:fetch_columns)[0].length)
+    assert_operator(@dbh['altpg_result_memory'], :<, held + 10_000)
+    sth.finish
+  end
+
+  def test_reexecute_after_release
+    @dbh.prepare('SELECT i FROM generate_series(1, 3) i') do |sth|
+      sth.execute
+      assert_equal([ [1], [2], [3] ], sth.fetch_all)
+      sth.execute
+      assert_equal([ [1], [2], [3] ], sth.fetch_all)
+
+      # Stopping at the last row, before DBI's own cancel
+      sth.execute
+      3.times { sth.fetch }
+      sth.execute
+      assert_equal([1], sth.fetch.to_a)
+
+      sth.execute
+      sth.func(:fetch_columns)
+      sth.execute
+      assert_equal([ [1], [2], [3] ], sth.fetch_all)
+    end
+  end
+
+  def test_read_only
+    assert_raises(DBI::ProgrammingError) do
+      @dbh['altpg_result_memory'] = 0
+    end
+  end
+end
@@ -0,0 +1,152 @@
+#!/usr/bin/env ruby
+
+require File.dirname(__FILE__) + "/test_helper"
+require 'socket'
+
+class TestAltPgRouter < Test::Unit::TestCase
+  # Both "replicas" are really further sessions on the test server, which
+  # is not in recovery and so never lags.
+  def connect(attr = {})
+    DBI.connect(TestHelper::ConnArgs[0], TestHelper::ConnArgs[1],
+                TestHelper::ConnArgs[2],
+                { 'altpg_replicas' => [ '', '' ] }.merge(attr))
+  end
+
+  def setup
+    @dbh = connect
+    @primary_pid = primary_pid
+  end
+
+  def teardown
+    @dbh.disconnect rescue nil
+  end
+
+  def primary_pid
+    @dbh['AutoCommit'] = false
+    pid = backend_pid
+    @dbh.commit
+    @dbh['AutoCommit'] = true
+    pid
+  end
+
+  def backend_pid
+    @dbh.select_one('SELECT pg_backend_pid()')[0]
+  end
+
+  def test_read_only
+    router = DBI::DBD::AltPg::Router
+    assert(router.read_only?('SELECT 1', 'select'))
+    assert(router.read_only?('VALUES (1)', 'values'))
+    assert(!router.read_only?('SELECT * FROM t FOR UPDATE', 'select'))
+    assert(!router.read_only?('SELECT 1 FROM t FOR NO KEY UPDATE', 'select'))
+    assert(!router.read_only?('SELECT * INTO t2 FROM t', 'select'))
+    assert(!router.read_only?(%q|SELECT nextval('s')|, 'select'))
+    assert(!router.read_only?('INSERT INTO t VALUES (1)', 'insert'))
+    assert(!router.read_only?('WITH d AS (DELETE FROM t) SELECT 1', 'with'))
+  end
+
+  def test_round_robin
+    pids = (1..4).collect { backend_pid }
+    assert(!pids.include?(@primary_pid))
+    assert_equal(2, pids.uniq.length)
+    assert_equal(pids[0, 2], pids[2, 2])
+  end
+
+  def test_transactions_stay_on_primary
+    @dbh['AutoCommit'] = false
+    assert_equal(@primary_pid, backend_pid)
+    @dbh.commit
+    @dbh['AutoCommit'] = true
+    assert_not_equal(@primary_pid, backend_pid)
+  end
+
+  def test_writes_on_primary
+    @dbh.do('CREATE TEMP TABLE r (pid INT)')
+    @dbh.do('INSERT INTO r SELECT pg_backend_pid()')
+    assert_equal(@primary_pid, @dbh.select_one('SELECT pid FROM r FOR SHARE')[0])
+  end
+
+  def test_least_busy
+    @dbh['altpg_balance'] = 'least_busy'
+    sth = @dbh.execute('SELECT pg_backend_pid() FROM generate_series(1, 1000)')
+    busy_pid = sth.fetch[0]
+    3.times { assert_not_equal(busy_pid, backend_pid) }
+    sth.finish
+  end
+
+  def test_lag_limit
+    status = @dbh['altpg_replica_status']
+    assert_equal(2, status.length)
+    assert(status.all? { |r| r['healthy'] and r['lag'] == 0.0 })
+
+    @dbh['altpg_replica_max_lag'] = -1
+    assert_equal(@primary_pid, backend_pid)
+    assert(@dbh['altpg_replica_status'].none? { |r| r['healthy'] })
+
+    @dbh['altpg_replica_max_lag'] = nil
+    assert_equal(2, @dbh.func(:check_replicas))
+    assert_not_equal(@primary_pid, backend_pid)
+  end
+
+  def test_unreachable_replica
+    dbh = connect('altpg_replicas' => 'port=1')
+    assert(!dbh['altpg_replica_status'][0]['healthy'])
+    assert_not_nil(dbh['altpg_replica_status'][0]['error'])
+    assert_nothing_raised { dbh.select_one('SELECT 1') }
+  ensure
+    dbh.disconnect rescue nil
+  end
+
+  def test_hung_replica
+    # Accepts connections (in the kernel) but never answers
+    server = TCPServer.new('127.0.0.1', 0)
+    started = Time.now
+    dbh = connect('altpg_replicas' => "host=127.0.0.1 port=#{server.addr[1]} sslmode=disable",
+                  'altpg_replica_check_interval' => 0)
+    assert_operator(Time.now - started, :<, 10)
+    assert_match(/timeout/, dbh['altpg_replica_status'][0]['error'])
+
+    # Backing off, reads don't wait on it again
+    started = Time.now
+    dbh.select_one('SELECT 1')
+    assert_operator(Time.now - started, :<, 1)
+  ensure
+    dbh.disconnect rescue nil
+    server.close rescue nil
+  end
+
+  def test_unresponsive_replica
+    # Completes the startup handshake, then never answers a query
+    server = TCPServer.new('127.0.0.1', 0)
+    acceptor = Thread.new do
+      loop do
+        Thread.new(server.accept) do |s|
+          s.read(s.read(4).unpack('N')[0] - 4)   # startup packet
+          s.write("R" + [8, 0].pack('NN') + "Z" + [5].pack('N') + "I")
+          s.read rescue nil
+        end
+      end
+    end
+    started = Time.now
+    dbh = connect('altpg_replicas' => "host=127.0.0.1 port=#{server.addr[1]} " \
+                                      "sslmode=disable gssencmode=disable",
+                  'altpg_replica_check_interval' => 0)
+    assert_operator(Time.now - started, :<, 10)
+    status = dbh['altpg_replica_status'][0]
+    assert(! status['healthy'])
+    assert_match(/timeout/, status['error'])
+
+    started = Time.now
+    dbh.select_one('SELECT 1')
+    assert_operator(Time.now - started, :<, 1)
+  ensure
+    dbh.disconnect rescue nil
+    acceptor.kill if acceptor
+    server.close rescue nil
+  end
+
+  def test_bad_attributes
+    assert_raises(DBI::ProgrammingError) { @dbh['altpg_balance'] = 'random' }
+    assert_raises(DBI::ProgrammingError) { @dbh['altpg_replica_status'] = [] }
+  end
+end
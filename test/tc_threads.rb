@@ -0,0 +1,43 @@
+#!/usr/bin/env ruby
+
+require File.dirname(__FILE__) + "/test_helper"
+require 'timeout'
+
+class TestAltPgThreads < Test::Unit::TestCase
+  def setup
+    @dbhs = (1..3).collect { DBI.connect(*TestHelper::ConnArgs) }
+  end
+
+  def teardown
+    @dbhs.each { |dbh| dbh.disconnect rescue nil }
+  end
+
+  def test_concurrent_queries
+    started = Time.now
+    @dbhs.collect { |dbh|
+      Thread.new { dbh.select_one('SELECT pg_sleep(2)') }
+    }.each { |t| t.join }
+
+    assert(Time.now - started < 4, "queries on separate connections were serialized")
+  end
+
+  def test_ruby_threads_run
+    ticks = 0
+    ticker = Thread.new { loop { ticks += 1; sleep 0.05 } }
+    @dbhs[0].select_one('SELECT pg_sleep(1)')
+    ticker.kill
+
+    assert(ticks > 5, "ruby thread starved during query")
+  end
+
+  def test_interrupt_cancels
+    dbh = @dbhs[0]
+    assert_raises(Timeout::Error) do
+      Timeout.timeout(1) { dbh.select_one('SELECT pg_sleep(30)') }
+    end
+
+    # The connection was left idle and usable
+    assert(! dbh.handle.in_transaction?)
+    assert_equal([1], dbh.select_one('SELECT 1'))
+  end
+end